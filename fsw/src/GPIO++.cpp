@@ -22,6 +22,165 @@
 
 using namespace YukiWorkshop;
 
+// The slot whose handler runs on this thread
+static thread_local const void *dispatching = nullptr;
+
+#if GPIOPP_USE_V2
+typedef gpio_v2_line_event event_record;
+
+static inline uint64_t event_timestamp(const event_record& __ev) {
+	return __ev.timestamp_ns;
+}
+
+static uint64_t line_flags_v2(GPIO::LineMode __mode) {
+	static const std::pair<GPIO::LineMode, uint64_t> map[] = {
+		{GPIO::LineMode::Input, GPIO_V2_LINE_FLAG_INPUT},
+		{GPIO::LineMode::Output, GPIO_V2_LINE_FLAG_OUTPUT},
+		{GPIO::LineMode::ActiveLow, GPIO_V2_LINE_FLAG_ACTIVE_LOW},
+		{GPIO::LineMode::OpenDrain, GPIO_V2_LINE_FLAG_OPEN_DRAIN},
+		{GPIO::LineMode::OpenSource, GPIO_V2_LINE_FLAG_OPEN_SOURCE},
+		{GPIO::LineMode::NoPull, GPIO_V2_LINE_FLAG_BIAS_DISABLED},
+		{GPIO::LineMode::PullUp, GPIO_V2_LINE_FLAG_BIAS_PULL_UP},
+		{GPIO::LineMode::PullDown, GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN},
+	};
+
+	uint64_t ret = 0;
+	for (auto &it : map) {
+		if ((int)it.first && (__mode & it.first) == it.first)
+			ret |= it.second;
+	}
+
+	// v2 rejects a bias on lines that are neither input nor output
+	if (!(ret & (GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_OUTPUT)))
+		ret &= ~(uint64_t)(GPIO_V2_LINE_FLAG_BIAS_DISABLED | GPIO_V2_LINE_FLAG_BIAS_PULL_UP | GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN);
+
+	return ret;
+}
+
+static GPIO::LineMode line_mode_v2(uint64_t __flags) {
+	GPIO::LineMode ret{};
+
+	if (__flags & GPIO_V2_LINE_FLAG_INPUT)
+		ret |= GPIO::LineMode::Input;
+	if (__flags & GPIO_V2_LINE_FLAG_OUTPUT)
+		ret |= GPIO::LineMode::Output;
+	if (__flags & GPIO_V2_LINE_FLAG_ACTIVE_LOW)
+		ret |= GPIO::LineMode::ActiveLow;
+	if (__flags & GPIO_V2_LINE_FLAG_OPEN_DRAIN)
+		ret |= GPIO::LineMode::OpenDrain;
+	if (__flags & GPIO_V2_LINE_FLAG_OPEN_SOURCE)
+		ret |= GPIO::LineMode::OpenSource;
+	if (__flags & GPIO_V2_LINE_FLAG_BIAS_DISABLED)
+		ret |= GPIO::LineMode::NoPull;
+	if (__flags & GPIO_V2_LINE_FLAG_BIAS_PULL_UP)
+		ret |= GPIO::LineMode::PullUp;
+	if (__flags & GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN)
+		ret |= GPIO::LineMode::PullDown;
+
+	return ret;
+}
+
+static uint64_t event_flags_v2(GPIO::LineMode __line_mode, GPIO::EventMode __event_mode, const GPIO::EventConfig& __config) {
+	// Edge detection needs an input line
+	uint64_t ret = line_flags_v2(__line_mode | GPIO::LineMode::Input) & ~(uint64_t)GPIO_V2_LINE_FLAG_OUTPUT;
+
+	if ((__event_mode & GPIO::EventMode::RisingEdge) == GPIO::EventMode::RisingEdge)
+		ret |= GPIO_V2_LINE_FLAG_EDGE_RISING;
+	if ((__event_mode & GPIO::EventMode::FallingEdge) == GPIO::EventMode::FallingEdge)
+		ret |= GPIO_V2_LINE_FLAG_EDGE_FALLING;
+
+	switch (__config.clock) {
+		case GPIO::EventClock::Monotonic:
+			break;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,11,0)
+		case GPIO::EventClock::Realtime:
+			ret |= GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME;
+			break;
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,19,0)
+		case GPIO::EventClock::Hte:
+			ret |= GPIO_V2_LINE_FLAG_EVENT_CLOCK_HTE;
+			break;
+#endif
+		default:
+			errno = EOPNOTSUPP;
+			throw ExceptionWithErrno("event clock not supported by these kernel headers");
+	}
+
+	return ret;
+}
+
+static uint64_t line_mask_v2(size_t __count) {
+	return __count >= 64 ? ~(uint64_t)0 : (((uint64_t)1 << __count) - 1);
+}
+
+// Returns the line request fd, or -1 with errno set
+static int request_lines_v2(int __chip_fd, const uint32_t *__offsets, const uint8_t *__default_values, size_t __count,
+			    uint64_t __flags, const std::string& __label, const GPIO::EventConfig& __config = {}) {
+	gpio_v2_line_request req{};
+
+	for (size_t i=0; i<__count; i++)
+		req.offsets[i] = __offsets[i];
+
+	req.num_lines = __count;
+	req.config.flags = __flags;
+	req.event_buffer_size = __config.buffer_size;
+	strncpy(req.consumer, __label.c_str(), GPIO_MAX_NAME_SIZE - 1);
+
+	if ((__flags & GPIO_V2_LINE_FLAG_OUTPUT) && __default_values) {
+		auto &attr = req.config.attrs[req.config.num_attrs++];
+		attr.attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+		for (size_t i=0; i<__count; i++) {
+			if (__default_values[i])
+				attr.attr.values |= (uint64_t)1 << i;
+		}
+		attr.mask = line_mask_v2(__count);
+	}
+
+	if (__config.debounce_us) {
+		auto &attr = req.config.attrs[req.config.num_attrs++];
+		attr.attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+		attr.attr.debounce_period_us = __config.debounce_us;
+		attr.mask = line_mask_v2(__count);
+	}
+
+	if (ioctl(__chip_fd, GPIO_V2_GET_LINE_IOCTL, &req))
+		return -1;
+
+	return req.fd;
+}
+#else
+typedef gpioevent_data event_record;
+
+static inline uint64_t event_timestamp(const event_record& __ev) {
+	return __ev.timestamp;
+}
+#endif
+
+clockid_t GPIO::event_clock_id(const EventConfig &__config) {
+#if GPIOPP_USE_V2
+	switch (__config.clock) {
+		case EventClock::Monotonic:
+			return CLOCK_MONOTONIC;
+		case EventClock::Realtime:
+			return CLOCK_REALTIME;
+		default:
+			return -1;
+	}
+#else
+	(void)__config;
+
+	// Whatever was asked for, v1 line events follow the running kernel
+	utsname uts;
+	unsigned major = 0, minor = 0;
+
+	if (uname(&uts) || sscanf(uts.release, "%u.%u", &major, &minor) != 2)
+		return CLOCK_MONOTONIC;
+
+	return (major > 5 || (major == 5 && minor >= 7)) ? CLOCK_MONOTONIC : CLOCK_REALTIME;
+#endif
+}
+
 std::vector<GPIO::Device> GPIO::all_devices() {
 	std::vector<GPIO::Device> ret;
 
@@ -75,11 +234,19 @@ void GPIO::Device::get_device_info() {
 std::map<uint32_t, std::string> &GPIO::Device::lines_by_num() {
 	if (lines_by_num_.empty()) {
 		for (uint32_t i=0; i<num_lines_; i++) {
+#if GPIOPP_USE_V2
+			gpio_v2_line_info linfo{};
+			linfo.offset = i;
+
+			if (ioctl(fd, GPIO_V2_GET_LINEINFO_IOCTL, &linfo))
+				throw ExceptionWithErrno("failed to get line info");
+#else
 			gpioline_info linfo{};
 			linfo.line_offset = i;
 
 			if (ioctl(fd, GPIO_GET_LINEINFO_IOCTL, &linfo))
 				throw ExceptionWithErrno("failed to get line info");
+#endif
 
 			lines_by_num_.insert({i, linfo.name});
 		}
@@ -91,11 +258,19 @@ std::map<uint32_t, std::string> &GPIO::Device::lines_by_num() {
 std::map<std::string, uint32_t> &GPIO::Device::lines_by_name() {
 	if (lines_by_name_.empty()) {
 		for (uint32_t i=0; i<num_lines_; i++) {
+#if GPIOPP_USE_V2
+			gpio_v2_line_info linfo{};
+			linfo.offset = i;
+
+			if (ioctl(fd, GPIO_V2_GET_LINEINFO_IOCTL, &linfo))
+				throw ExceptionWithErrno("failed to get line info");
+#else
 			gpioline_info linfo{};
 			linfo.line_offset = i;
 
 			if (ioctl(fd, GPIO_GET_LINEINFO_IOCTL, &linfo))
 				throw ExceptionWithErrno("failed to get line info");
+#endif
 
 			lines_by_name_.insert({linfo.name, i});
 		}
@@ -105,11 +280,32 @@ std::map<std::string, uint32_t> &GPIO::Device::lines_by_name() {
 }
 
 void GPIO::Device::open(const std::string &__path) {
+	// Opened again by a copy assignment, don't leak what the previous open made.
+	// Its tasks run here, some close removed timers, its listener is gone.
+	run_tasks();
+
+	for (auto &it : timer_slots) {
+		if (it.fd >= 0)
+			close(it.fd);
+	}
+	timer_slots.clear();
+
+	for (int *it : {&fd, &epfd, &wakefd}) {
+		if (*it >= 0) {
+			close(*it);
+			*it = -1;
+		}
+	}
+
 	if ((fd = ::open(__path.c_str(), O_RDWR)) == -1)
 		throw ExceptionWithErrno("failed to open device");
 
 	get_device_info();
 	path_ = __path;
+	event_slots = std::make_unique<EventSlot[]>(num_lines_);
+
+	if ((wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1)
+		throw ExceptionWithErrno("failed to create eventfd");
 
 	if (debug)
 		std::cerr << "GPIO++: " << "Device " << __path << " opened";
@@ -121,7 +317,9 @@ void GPIO::Device::open(uint32_t __id) {
 
 GPIO::LineSingle
 GPIO::Device::line(uint32_t __line_number, GPIO::LineMode __mode, uint8_t __default_value, const std::string &__label) {
+#if !GPIOPP_USE_V2
 	gpiohandle_request req{};
+#endif
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5,4,0)
 	if (!((__mode & LineMode::PullUp) == LineMode::PullUp || (__mode & LineMode::PullDown) == LineMode::PullDown)) {
@@ -129,6 +327,19 @@ GPIO::Device::line(uint32_t __line_number, GPIO::LineMode __mode, uint8_t __defa
 	}
 #endif
 
+#if GPIOPP_USE_V2
+	int line_fd = request_lines_v2(fd, &__line_number, &__default_value, 1, line_flags_v2(__mode), __label);
+	if (line_fd < 0)
+		throw ExceptionWithErrno("failed to get line handle");
+
+	gpio_v2_line_info linfo{};
+	linfo.offset = __line_number;
+
+	if (ioctl(fd, GPIO_V2_GET_LINEINFO_IOCTL, &linfo)) {
+		close(line_fd);
+		throw ExceptionWithErrno("failed to get line info");
+	}
+#else
 	req.lineoffsets[0] = __line_number;
 	req.default_values[0] = __default_value;
 	req.flags = (uint32_t)__mode;
@@ -138,17 +349,20 @@ GPIO::Device::line(uint32_t __line_number, GPIO::LineMode __mode, uint8_t __defa
 	if (ioctl(fd, GPIO_GET_LINEHANDLE_IOCTL, &req))
 		throw ExceptionWithErrno("failed to get line handle");
 
+	int line_fd = req.fd;
+
 	gpioline_info linfo{};
 	linfo.line_offset = __line_number;
 
 	if (ioctl(fd, GPIO_GET_LINEINFO_IOCTL, &linfo))
 		throw ExceptionWithErrno("failed to get line info");
+#endif
 
 	if (debug)
 		std::cerr << "GPIO++: " << "Line " << __line_number << " opened, mode="
 			  << (uint)__mode << ", default_value=" << __default_value << ", label=" << __label << "\n";
 
-	return LineSingle(req.fd, fd, 1, linfo);
+	return LineSingle(line_fd, fd, 1, linfo);
 }
 
 GPIO::LineMultiple
@@ -168,6 +382,11 @@ GPIO::Device::line(const std::initializer_list<LineSpec> &__lss, GPIO::LineMode
 	}
 #endif
 
+#if GPIOPP_USE_V2
+	int line_fd = request_lines_v2(fd, req.lineoffsets, req.default_values, usable_size, line_flags_v2(__mode), __label);
+	if (line_fd < 0)
+		throw ExceptionWithErrno("failed to get line handle");
+#else
 	strncpy(req.consumer_label, __label.c_str(), 31);
 	req.flags = (uint32_t)__mode;
 	req.lines = usable_size;
@@ -175,6 +394,9 @@ GPIO::Device::line(const std::initializer_list<LineSpec> &__lss, GPIO::LineMode
 	if (ioctl(fd, GPIO_GET_LINEHANDLE_IOCTL, &req))
 		throw ExceptionWithErrno("failed to get line handle");
 
+	int line_fd = req.fd;
+#endif
+
 	if (debug)
 		for (uint8_t i=0; i<usable_size; i++) {
 			std::cerr << "GPIO++: " << "Line(M) " << (__lss.begin()+i)->line_number << " opened, mode="
@@ -182,12 +404,23 @@ GPIO::Device::line(const std::initializer_list<LineSpec> &__lss, GPIO::LineMode
 		}
 
 
-	return LineMultiple(req.fd, usable_size);
+	return LineMultiple(line_fd, usable_size);
 }
 
-int GPIO::Device::add_event(uint32_t __line_number, GPIO::LineMode __line_mode, GPIO::EventMode __event_mode,
-			    const std::function<void(EventType, uint64_t)>& __handler, const std::string &__label) {
-	std::unique_lock<std::shared_mutex> lk(event_lock);
+int GPIO::Device::request_event(uint32_t __line_number, GPIO::LineMode __line_mode, GPIO::EventMode __event_mode,
+				const std::string &__label, const EventConfig &__config) {
+#if GPIOPP_USE_V2
+	int event_fd = request_lines_v2(fd, &__line_number, nullptr, 1, event_flags_v2(__line_mode, __event_mode, __config),
+					__label, __config);
+	if (event_fd < 0)
+		throw ExceptionWithErrno("failed to setup events");
+
+	return event_fd;
+#else
+	if (__config.clock != EventClock::Realtime && __config.clock != EventClock::Monotonic) {
+		errno = EOPNOTSUPP;
+		throw ExceptionWithErrno("event clock not supported by the v1 uAPI");
+	}
 
 	gpioevent_request req{};
 	req.lineoffset = __line_number;
@@ -195,50 +428,167 @@ int GPIO::Device::add_event(uint32_t __line_number, GPIO::LineMode __line_mode,
 	req.eventflags = (uint32_t)__event_mode;
 	strncpy(req.consumer_label, __label.c_str(), 31);
 
-	if (ioctl(fd, GPIO_GET_LINEEVENT_IOCTL, &req)) {
+	if (ioctl(fd, GPIO_GET_LINEEVENT_IOCTL, &req))
 		throw ExceptionWithErrno("failed to setup events");
+
+	return req.fd;
+#endif
+}
+
+GPIO::LineEvent GPIO::Device::line_event(uint32_t __line_number, GPIO::LineMode __line_mode, GPIO::EventMode __event_mode,
+				       const std::string &__label, const EventConfig &__config) {
+	int event_fd = request_event(__line_number, __line_mode, __event_mode, __label, __config);
+
+	if (debug)
+		std::cerr << "GPIO++: " << "Line " << __line_number << " event handle opened, label=" << __label << "\n";
+
+	return LineEvent(event_fd, __line_number);
+}
+
+int GPIO::Device::add_event(uint32_t __line_number, GPIO::LineMode __line_mode, GPIO::EventMode __event_mode,
+			    const std::function<void(EventType, uint64_t)>& __handler, const std::string &__label,
+			    const EventConfig &__config) {
+	std::unique_lock<std::shared_mutex> lk(event_lock);
+
+	if (__line_number >= num_lines_)
+		throw std::logic_error("line number out of range");
+
+	auto &slot = event_slots[__line_number];
+
+	// A dispatch may still run the handler of a removed event, don't replace it under it
+	if (dispatching == &slot)
+		throw std::logic_error("line event added again from its own handler");
+
+	while (slot.busy.load()) {
+		lk.unlock();
+		std::this_thread::yield();
+		lk.lock();
 	}
 
-	events_map.insert({req.fd, __handler});
+	if (slot.fd.load(std::memory_order_relaxed) >= 0)
+		throw std::logic_error("line already has an event handler");
+
+	int event_fd = request_event(__line_number, __line_mode, __event_mode, __label, __config);
+
+	slot.handler = __handler;
+	slot.fd.store(event_fd, std::memory_order_release);
 
 	if (epfd > 0) {
-		epoll_event ev;
+		epoll_event ev{};
 		ev.events = EPOLLIN;
-		ev.data.fd = req.fd;
+		ev.data.ptr = &slot;
 
-		epoll_ctl(epfd, EPOLL_CTL_ADD, req.fd, &ev);
+		epoll_ctl(epfd, EPOLL_CTL_ADD, event_fd, &ev);
 	}
 
-	return req.fd;
+	return event_fd;
 }
 
 void GPIO::Device::remove_event(int __event_handle) {
 	std::unique_lock<std::shared_mutex> lk(event_lock);
 
+	auto slot = find_event_slot(__event_handle);
+	if (!slot)
+		return;
+
 	if (epfd > 0)
 		epoll_ctl(epfd, EPOLL_CTL_DEL, __event_handle, nullptr);
 
-	events_map.erase(__event_handle);
+	// The handler is kept, a dispatch already past the fd check may still be running it
+	slot->fd.store(-1, std::memory_order_release);
+}
+
+GPIO::Device::EventSlot *GPIO::Device::find_event_slot(int __event_handle) {
+	if (__event_handle < 0)
+		return nullptr;
+
+	for (uint32_t i=0; i<num_lines_; i++) {
+		if (event_slots[i].fd.load(std::memory_order_acquire) == __event_handle)
+			return &event_slots[i];
+	}
+
+	return nullptr;
 }
 
-void GPIO::Device::process_event(int __event_handle) {
+// Marks a slot busy for the length of a dispatch, before its fd is looked at
+template <typename Slot>
+struct DispatchScope {
+	Slot *slot;
+	const void *outer;
+
+	explicit DispatchScope(Slot *__slot) : slot(__slot), outer(dispatching) {
+		slot->busy.fetch_add(1);
+		dispatching = slot;
+	}
+
+	~DispatchScope() {
+		dispatching = outer;
+		slot->busy.fetch_sub(1);
+	}
+};
+
+int GPIO::Device::dispatch_event(EventSlot *__slot) noexcept {
+	DispatchScope<EventSlot> scope(__slot);
+
+	int event_fd = __slot->fd.load();
+	if (event_fd < 0)
+		return -EBADF;
+
+	// Drain everything queued since the last wakeup in one read so bursts are not lost
+	event_record events[64];
+	ssize_t len = read(event_fd, events, sizeof(events));
+
+	if (len < (ssize_t)sizeof(event_record)) {
+		__slot->errors.fetch_add(1, std::memory_order_relaxed);
+		return len < 0 ? -errno : -EIO;
+	}
+
+	for (size_t i=0; i<len / sizeof(event_record); i++) {
+		// Nothing to hand it to on the listener thread, and the other events still need serving
+		try {
+			__slot->handler((EventType)events[i].id, event_timestamp(events[i]));
+		} catch (...) {
+			__slot->errors.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	return 0;
+}
+
+int GPIO::Device::process_event(int __event_handle) {
+	auto slot = find_event_slot(__event_handle);
+
+	return slot ? dispatch_event(slot) : -EBADF;
+}
+
+uint32_t GPIO::Device::event_errors() const {
+	uint32_t ret = 0;
+
+	for (uint32_t i=0; i<num_lines_; i++)
+		ret += event_slots[i].errors.load(std::memory_order_relaxed);
+
+	return ret;
+}
+
+uint32_t GPIO::Device::timer_errors() {
 	std::shared_lock<std::shared_mutex> lk(event_lock);
 
-	gpioevent_data event;
-	auto it = events_map.find(__event_handle);
-	if (it != events_map.end() &&
-	    read(__event_handle, &event, sizeof(gpioevent_data)) == sizeof(gpioevent_data))
-		events_map[__event_handle]((EventType)event.id, event.timestamp);
-	else
-		throw std::logic_error("event handle not found, check your code!");
+	uint32_t ret = 0;
+
+	for (auto &it : timer_slots)
+		ret += it.errors.load(std::memory_order_relaxed);
+
+	return ret;
 }
 
 std::vector<int> GPIO::Device::event_fds() {
 	std::shared_lock<std::shared_mutex> lk(event_lock);
 
 	std::vector<int> ret;
-	for (auto &it : events_map) {
-		ret.emplace_back(it.first);
+	for (uint32_t i=0; i<num_lines_; i++) {
+		int event_fd = event_slots[i].fd.load(std::memory_order_acquire);
+		if (event_fd >= 0)
+			ret.emplace_back(event_fd);
 	}
 	return ret;
 }
@@ -246,72 +596,494 @@ std::vector<int> GPIO::Device::event_fds() {
 bool GPIO::Device::is_event_fd(int __fd) {
 	std::shared_lock<std::shared_mutex> lk(event_lock);
 
-	return events_map.find(__fd) != events_map.end();
+	return find_event_slot(__fd) != nullptr;
+}
+
+static void wake_eventfd(int __fd) {
+	uint64_t one = 1;
+	write(__fd, &one, sizeof(one));
+}
+
+static void clear_eventfd(int __fd) {
+	uint64_t cnt;
+	read(__fd, &cnt, sizeof(cnt));
+}
+
+static int make_timer(std::chrono::nanoseconds __first, std::chrono::nanoseconds __interval) {
+	int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (tfd < 0)
+		throw ExceptionWithErrno("failed to create timerfd");
+
+	// A zero it_value would disarm the timer
+	auto first = std::max(__first, std::chrono::nanoseconds(1));
+
+	itimerspec its{};
+	its.it_value.tv_sec = first.count() / 1000000000;
+	its.it_value.tv_nsec = first.count() % 1000000000;
+	its.it_interval.tv_sec = __interval.count() / 1000000000;
+	its.it_interval.tv_nsec = __interval.count() % 1000000000;
+
+	if (timerfd_settime(tfd, 0, &its, nullptr)) {
+		close(tfd);
+		throw ExceptionWithErrno("failed to arm timerfd");
+	}
+
+	return tfd;
+}
+
+void GPIO::Device::wake() {
+	wake_eventfd(wakefd);
+}
+
+void GPIO::Device::post(std::function<void()> __task) {
+	{
+		std::lock_guard<std::mutex> lg(task_lock);
+		tasks.push_back(std::move(__task));
+	}
+
+	wake();
+}
+
+void GPIO::Device::run_tasks() {
+	std::vector<std::function<void()>> pending;
+
+	{
+		std::lock_guard<std::mutex> lg(task_lock);
+		pending.swap(tasks);
+	}
+
+	for (auto &it : pending)
+		it();
+}
+
+int GPIO::Device::add_timer(std::chrono::nanoseconds __first, std::chrono::nanoseconds __interval,
+			    const std::function<void(uint64_t)> &__handler) {
+	std::unique_lock<std::shared_mutex> lk(event_lock);
+
+	// A free slot whose handler may still be running is left alone
+	auto slot = std::find_if(timer_slots.begin(), timer_slots.end(), [](const TimerSlot& ts) { return ts.fd < 0 && !ts.busy; });
+	if (slot == timer_slots.end())
+		slot = timer_slots.emplace(timer_slots.end());
+
+	int tfd = make_timer(__first, __interval);
+
+	slot->handler = __handler;
+	slot->fd.store(tfd, std::memory_order_release);
+
+	if (epfd > 0) {
+		epoll_event ev{};
+		ev.events = EPOLLIN;
+		ev.data.ptr = &*slot;
+
+		epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+	}
+
+	return tfd;
+}
+
+void GPIO::Device::remove_timer(int __timer_handle) {
+	std::unique_lock<std::shared_mutex> lk(event_lock);
+
+	auto slot = std::find_if(timer_slots.begin(), timer_slots.end(),
+				 [__timer_handle](const TimerSlot& ts) { return ts.fd == __timer_handle; });
+	if (__timer_handle < 0 || slot == timer_slots.end())
+		return;
+
+	slot->fd.store(-1, std::memory_order_release);
+
+	if (epfd > 0) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, __timer_handle, nullptr);
+
+		// The listener may be about to read it, close it from there so the fd number isn't reused under it
+		lk.unlock();
+		post([__timer_handle]() { close(__timer_handle); });
+	} else {
+		close(__timer_handle);
+	}
+}
+
+void GPIO::Device::dispatch_timer(TimerSlot *__slot) noexcept {
+	DispatchScope<TimerSlot> scope(__slot);
+
+	int tfd = __slot->fd.load();
+	uint64_t expirations;
+
+	if (tfd < 0 || read(tfd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return;
+
+	try {
+		__slot->handler(expirations);
+	} catch (...) {
+		__slot->errors.fetch_add(1, std::memory_order_relaxed);
+	}
 }
 
 void GPIO::Device::run_eventlistener() {
-	eventlistener_run = true;
+	std::unique_lock<std::shared_mutex> lk(event_lock);
 
 	epfd = epoll_create(42);
 
-	std::shared_lock<std::shared_mutex> lk(event_lock);
-	for (auto &it : events_map) {
-		epoll_event ev;
-		ev.events = EPOLLIN;
-		ev.data.fd = it.first;
+	epoll_event ev{};
+	ev.events = EPOLLIN;
+	ev.data.ptr = &wakefd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+
+	for (uint32_t i=0; i<num_lines_; i++) {
+		int event_fd = event_slots[i].fd.load(std::memory_order_acquire);
+		if (event_fd < 0)
+			continue;
 
-		epoll_ctl(epfd, EPOLL_CTL_ADD, it.first, &ev);
+		ev.data.ptr = &event_slots[i];
+		epoll_ctl(epfd, EPOLL_CTL_ADD, event_fd, &ev);
+	}
+
+	for (auto &it : timer_slots) {
+		int tfd = it.fd.load(std::memory_order_acquire);
+		if (tfd < 0)
+			continue;
+
+		ev.data.ptr = &it;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
 	}
 	lk.unlock();
 
+	// Posted before the listener started
+	run_tasks();
+
 	int ep_rc;
 	epoll_event evs[16];
+	EventSlot *slots_begin = event_slots.get(), *slots_end = slots_begin + num_lines_;
 
-	while ((ep_rc = epoll_wait(epfd, evs, 16, 1000)) != -1) {
-		if (ep_rc > 0) {
-         //cfs error: comparison of integer expressions of different signedness: ‘uint’ {aka ‘unsigned int’} and ‘int’
-			//cfs for (uint i=0; i<ep_rc; i++)
-         for (int i=0; i<ep_rc; i++) //cfs
-				process_event(evs[i].data.fd);
-		}
+	while (!eventlistener_stop.load(std::memory_order_acquire)) {
+		ep_rc = epoll_wait(epfd, evs, 16, -1);
 
-		if (!eventlistener_run) {
-			close(epfd);
-			epfd = -1;
+		if (ep_rc == -1) {
+			if (errno == EINTR)
+				continue;
 			break;
 		}
+
+		bool woken = false;
+
+		for (int i=0; i<ep_rc; i++) {
+			void *ptr = evs[i].data.ptr;
+
+			if (ptr == &wakefd)
+				woken = true;
+			else if (ptr >= slots_begin && ptr < slots_end)
+				dispatch_event(static_cast<EventSlot *>(ptr));
+			else
+				dispatch_timer(static_cast<TimerSlot *>(ptr));
+		}
+
+		// Tasks run after the batch, so one freeing a slot can't pull it from under a pending event
+		if (woken) {
+			clear_eventfd(wakefd);
+			run_tasks();
+		}
 	}
 
+	lk.lock();
+	close(epfd);
+	epfd = -1;
+	lk.unlock();
+
+	// This run consumed the stop
+	eventlistener_stop = false;
+
+	run_tasks();
 }
 
 void GPIO::Device::stop_eventlistener() {
-	eventlistener_run = false;
+	eventlistener_stop = true;
+
+	if (wakefd > 0)
+		wake();
+}
+
+GPIO::Reactor::Reactor() {
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (epfd < 0)
+		throw ExceptionWithErrno("failed to create epoll instance");
+
+	if ((wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1) {
+		close(epfd);
+		throw ExceptionWithErrno("failed to create eventfd");
+	}
+
+	// The wake source is the only one without a Source, its data pointer is null
+	epoll_event ev{};
+	ev.events = EPOLLIN;
+	ev.data.ptr = nullptr;
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev)) {
+		close(wakefd);
+		close(epfd);
+		throw ExceptionWithErrno("failed to add eventfd to reactor");
+	}
+}
+
+GPIO::Reactor::~Reactor() {
+	stop();
+
+	if (epfd > 0)
+		close(epfd);
+	if (wakefd > 0)
+		close(wakefd);
+}
+
+void GPIO::Reactor::add(GPIO::Device &__dev) {
+	std::shared_lock<std::shared_mutex> lk(__dev.event_lock);
+
+	for (uint32_t i=0; i<__dev.num_lines_; i++) {
+		auto slot = &__dev.event_slots[i];
+		int event_fd = slot->fd.load(std::memory_order_acquire);
+
+		if (event_fd >= 0)
+			add(event_fd, [slot](uint32_t) { Device::dispatch_event(slot); });
+	}
+}
+
+void GPIO::Reactor::add(int __fd, const std::function<void(uint32_t)> &__handler, uint32_t __events) {
+	std::lock_guard<std::mutex> lg(sources_lock);
+
+	if (sources.find(__fd) != sources.end())
+		throw std::logic_error("fd already added to reactor");
+
+	auto src = std::make_unique<Source>();
+	src->fd = __fd;
+	src->handler = __handler;
+
+	epoll_event ev{};
+	ev.events = __events;
+	ev.data.ptr = src.get();
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, __fd, &ev))
+		throw ExceptionWithErrno("failed to add fd to reactor");
+
+	sources.insert({__fd, std::move(src)});
+}
+
+void GPIO::Reactor::remove(GPIO::Device &__dev) {
+	for (auto it : __dev.event_fds())
+		remove(it);
+}
+
+void GPIO::Reactor::remove(int __fd) {
+	Source *src;
+
+	{
+		std::lock_guard<std::mutex> lg(sources_lock);
+
+		auto it = sources.find(__fd);
+		if (it == sources.end())
+			return;
+
+		epoll_ctl(epfd, EPOLL_CTL_DEL, __fd, nullptr);
+
+		// epoll_wait() may have returned it already, keep it until the loop is done with the batch
+		src = it->second.get();
+		src->alive.store(false);
+		removed.push_back(std::move(it->second));
+		sources.erase(it);
+		removed_pending.store(true, std::memory_order_release);
+	}
+
+	// The loop marks the source running before it checks alive, so either it skips the
+	// handler or we see it running. Freed by the loop only after the batch, src stays valid.
+	if (loop_thread_.load() == std::this_thread::get_id())
+		return;
+
+	while (running_.load() == src)
+		std::this_thread::yield();
+}
+
+void GPIO::Reactor::free_removed() {
+	std::lock_guard<std::mutex> lg(sources_lock);
+
+	removed.clear();
+	removed_pending.store(false, std::memory_order_relaxed);
+}
+
+static int set_affinity(pthread_t __tid, const std::vector<int> &__cpus) {
+	if (__cpus.empty())
+		return 0;
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	for (auto it : __cpus)
+		CPU_SET(it, &cpus);
+
+	return pthread_setaffinity_np(__tid, sizeof(cpus), &cpus);
+}
+
+void GPIO::Reactor::run(const std::vector<int> &__cpus) {
+	int rc = set_affinity(pthread_self(), __cpus);
+	if (rc)
+		throw std::system_error(rc, std::system_category(), "failed to set reactor affinity");
+
+	run_ = true;
+	loop();
+}
+
+void GPIO::Reactor::loop() {
+	int ep_rc;
+	epoll_event evs[16];
+
+	loop_thread_ = std::this_thread::get_id();
+
+	while (run_.load(std::memory_order_acquire)) {
+		ep_rc = epoll_wait(epfd, evs, 16, -1);
+
+		if (ep_rc == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		bool woken = false;
+
+		for (int i=0; i<ep_rc; i++) {
+			auto src = static_cast<Source *>(evs[i].data.ptr);
+
+			if (!src) {
+				woken = true;
+				continue;
+			}
+
+			running_.store(src);
+
+			try {
+				if (src->alive.load())
+					src->handler(evs[i].events);
+			} catch (...) {
+				running_.store(nullptr);
+				throw;
+			}
+
+			running_.store(nullptr);
+		}
+
+		if (woken) {
+			clear_eventfd(wakefd);
+			run_tasks();
+		}
+
+		if (removed_pending.load(std::memory_order_acquire))
+			free_removed();
+	}
+
+	run_tasks();
+
+	loop_thread_ = std::thread::id();
+}
+
+void GPIO::Reactor::post(std::function<void()> __task) {
+	{
+		std::lock_guard<std::mutex> lg(task_lock);
+		tasks.push_back(std::move(__task));
+	}
+
+	wake_eventfd(wakefd);
+}
+
+void GPIO::Reactor::run_tasks() {
+	std::vector<std::function<void()>> pending;
+
+	{
+		std::lock_guard<std::mutex> lg(task_lock);
+		pending.swap(tasks);
+	}
+
+	for (auto &it : pending)
+		it();
+}
+
+void GPIO::Reactor::start(const std::vector<int> &__cpus, int __prio) {
+	if (thread_.joinable())
+		throw std::logic_error("reactor already running");
+
+	// Set before the thread starts so a quick stop() isn't lost
+	run_ = true;
+	thread_ = std::thread(&Reactor::loop, this);
+
+	int rc = set_affinity(thread_.native_handle(), __cpus);
+
+	if (!rc && __prio > 0) {
+		sched_param param;
+		param.sched_priority = __prio;
+		rc = pthread_setschedparam(thread_.native_handle(), SCHED_RR, &param);
+	}
+
+	if (rc) {
+		stop();
+		throw std::system_error(rc, std::system_category(), "failed to set reactor thread attributes");
+	}
+}
+
+void GPIO::Reactor::stop() {
+	run_ = false;
+	wake_eventfd(wakefd);
+
+	if (thread_.joinable() && thread_.get_id() != std::this_thread::get_id())
+		thread_.join();
 }
 
 uint8_t GPIO::LineSingle::read() {
+#if GPIOPP_USE_V2
+	gpio_v2_line_values data{};
+	data.mask = 1;
+
+	if (ioctl(fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &data))
+		throw ExceptionWithErrno("failed to read value from line");
+
+	uint8_t value = data.bits & 1;
+#else
 	gpiohandle_data data{};
 
 	if (ioctl(fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data))
 		throw ExceptionWithErrno("failed to read value from line");
 
+	uint8_t value = data.values[0];
+#endif
+
 	if (debug)
-		std::cerr << "GPIO++: " << "Line " << number() << " '" << label() << "': value read: " << +data.values[0] << "\n";
+		std::cerr << "GPIO++: " << "Line " << number() << " '" << label() << "': value read: " << +value << "\n";
 
-	return data.values[0];
+	return value;
 }
 
 void GPIO::LineSingle::write(uint8_t __value) {
+#if GPIOPP_USE_V2
+	gpio_v2_line_values data{};
+	data.bits = __value ? 1 : 0;
+	data.mask = 1;
+
+	if (ioctl(fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &data))
+		throw ExceptionWithErrno("failed to write value to line");
+#else
 	gpiohandle_data data{};
 	data.values[0] = __value;
 
 	if (ioctl(fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data))
 		throw ExceptionWithErrno("failed to write value to line");
+#endif
 
 	if (debug)
-		std::cerr << "GPIO++: " << "Line " << number() << " '" << label() << "': value write: " << +data.values[0] << "\n";
+		std::cerr << "GPIO++: " << "Line " << number() << " '" << label() << "': value write: " << +__value << "\n";
 }
 
 GPIO::LineMode GPIO::LineSingle::mode() const {
+#if GPIOPP_USE_V2
+	gpio_v2_line_info linfo{};
+	linfo.offset = offset_;
+
+	if (ioctl(pfd, GPIO_V2_GET_LINEINFO_IOCTL, &linfo))
+		throw ExceptionWithErrno("failed to get line info");
+
+	return line_mode_v2(linfo.flags);
+#else
 	gpioline_info linfo{};
 	linfo.line_offset = offset_;
 
@@ -319,9 +1091,31 @@ GPIO::LineMode GPIO::LineSingle::mode() const {
 		throw ExceptionWithErrno("failed to get line info");
 
 	return (LineMode)linfo.flags;
+#endif
 }
 
 void GPIO::LineSingle::set_mode(GPIO::LineMode __mode, uint8_t __default_value, const std::string &__label) {
+#if GPIOPP_USE_V2
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,4,0)
+	if (!((__mode & LineMode::PullUp) == LineMode::PullUp || (__mode & LineMode::PullDown) == LineMode::PullDown)) {
+		__mode |= LineMode::NoPull;
+	}
+#endif
+
+	// Reconfigured in place, the line stays requested and keeps its label
+	gpio_v2_line_config cfg{};
+	cfg.flags = line_flags_v2(__mode);
+
+	if (cfg.flags & GPIO_V2_LINE_FLAG_OUTPUT) {
+		auto &attr = cfg.attrs[cfg.num_attrs++];
+		attr.attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+		attr.attr.values = __default_value ? 1 : 0;
+		attr.mask = 1;
+	}
+
+	if (ioctl(fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &cfg))
+		throw ExceptionWithErrno("failed to set line config");
+#else
 	close(fd);
 
 	gpiohandle_request req{};
@@ -341,24 +1135,106 @@ void GPIO::LineSingle::set_mode(GPIO::LineMode __mode, uint8_t __default_value,
 	if (ioctl(pfd, GPIO_GET_LINEHANDLE_IOCTL, &req))
 		throw ExceptionWithErrno("failed to get line handle");
 
+	fd = req.fd;
+#endif
+
 	if (debug)
 		std::cerr << "GPIO++: " << "Line " << number() << ": mode changed, mode="
 			  << (uint)__mode << ", default_value=" << __default_value << ", label=" << __label << "\n";
-
-	fd = req.fd;
 }
 
 std::vector<uint8_t> GPIO::LineMultiple::read() {
+#if GPIOPP_USE_V2
+	gpio_v2_line_values data{};
+	data.mask = line_mask_v2(size);
+
+	if (ioctl(fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &data))
+		throw ExceptionWithErrno("failed to read values from lines");
+
+	std::vector<uint8_t> ret(size);
+	for (size_t i=0; i<size; i++)
+		ret[i] = (data.bits >> i) & 1;
+#else
 	std::vector<uint8_t> ret(sizeof(gpiohandle_data));
 
 	if (ioctl(fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, ret.data()))
 		throw ExceptionWithErrno("failed to read values from lines");
 
 	ret.resize(size);
+#endif
 	return ret;
 }
 
 void GPIO::LineMultiple::write(const std::vector<uint8_t> &__values) {
-	if (ioctl(fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, __values.data()))
+#if GPIOPP_USE_V2
+	// All lines are set in one ioctl, lines beyond __values keep their state
+	gpio_v2_line_values data{};
+	size_t count = std::min<size_t>(__values.size(), size);
+
+	for (size_t i=0; i<count; i++) {
+		if (__values[i])
+			data.bits |= (uint64_t)1 << i;
+	}
+	data.mask = line_mask_v2(count);
+
+	if (ioctl(fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &data))
+		throw ExceptionWithErrno("failed to write values to lines");
+#else
+	// The kernel reads a whole gpiohandle_data
+	gpiohandle_data data{};
+	memcpy(data.values, __values.data(), std::min<size_t>(__values.size(), size));
+
+	if (ioctl(fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data))
 		throw ExceptionWithErrno("failed to write values to lines");
+#endif
+}
+
+uint8_t GPIO::LineEvent::read() {
+#if GPIOPP_USE_V2
+	gpio_v2_line_values data{};
+	data.mask = 1;
+
+	if (ioctl(fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &data))
+		throw ExceptionWithErrno("failed to read value from line");
+
+	return data.bits & 1;
+#else
+	gpiohandle_data data{};
+
+	// Event handles accept the line handle value ioctl too
+	if (ioctl(fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data))
+		throw ExceptionWithErrno("failed to read value from line");
+
+	return data.values[0];
+#endif
+}
+
+bool GPIO::LineEvent::wait(std::chrono::nanoseconds __timeout, GPIO::EventType *__type, uint64_t *__timestamp) {
+	pollfd pfd{fd, POLLIN, 0};
+	timespec ts;
+	ts.tv_sec = __timeout.count() / 1000000000;
+	ts.tv_nsec = __timeout.count() % 1000000000;
+
+	int rc = ppoll(&pfd, 1, &ts, nullptr);
+	if (rc < 0) {
+		if (errno == EINTR)
+			return false;
+		throw ExceptionWithErrno("failed to wait for event");
+	}
+
+	if (rc == 0)
+		return false;
+
+	event_record events[16];
+	ssize_t len = ::read(fd, events, sizeof(events));
+	if (len < (ssize_t)sizeof(event_record))
+		throw ExceptionWithErrno("failed to read event");
+
+	auto &last = events[len / sizeof(event_record) - 1];
+	if (__type)
+		*__type = (EventType)last.id;
+	if (__timestamp)
+		*__timestamp = event_timestamp(last);
+
+	return true;
 }
@@ -24,12 +24,21 @@
 #include <initializer_list>
 #include <unordered_map>
 #include <map>
+#include <list>
 #include <functional>
 #include <shared_mutex>
 #include <stdexcept>
 #include <system_error>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 #include <cstring>
+#include <cstdio>
+#include <ctime>
 #include <cinttypes>
 
 #include <fcntl.h>
@@ -38,6 +47,10 @@
 #include <linux/types.h>
 #include <linux/version.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/utsname.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 
 #include "Utils.hpp"
@@ -54,6 +67,14 @@
 #define GPIOHANDLE_REQUEST_BIAS_PULL_DOWN 0
 #endif
 
+// Use the v2 character device uAPI (Linux 5.10+) whenever the headers provide it,
+// define GPIOPP_USE_V1 to force the deprecated v1 ioctls
+#if defined(GPIO_V2_GET_LINE_IOCTL) && !defined(GPIOPP_USE_V1)
+#define GPIOPP_USE_V2 1
+#else
+#define GPIOPP_USE_V2 0
+#endif
+
 namespace YukiWorkshop::GPIO {
 	class Device;
 	class Line;
@@ -81,6 +102,20 @@ namespace YukiWorkshop::GPIO {
 		Both = RisingEdge | FallingEdge
 	};
 
+	// Clock of event timestamps. The v1 backend can't pick one, the kernel stamps
+	// Realtime before Linux 5.7 and Monotonic since: see event_clock_id().
+	enum class EventClock : int {
+		Monotonic,
+		Realtime,
+		Hte
+	};
+
+	struct EventConfig {
+		EventClock clock = EventClock::Monotonic;
+		uint32_t buffer_size = 0;	// Kernel event buffer depth, 0 for the kernel default (16 per line). v2 only.
+		uint32_t debounce_us = 0;	// v2 only
+	};
+
 	inline constexpr LineMode operator&(LineMode x, LineMode y) {
 		return static_cast<LineMode>(static_cast<int>(x) & static_cast<int>(y));
 	}
@@ -208,10 +243,20 @@ namespace YukiWorkshop::GPIO {
 			label_ = __info.consumer;
 		}
 
+#if GPIOPP_USE_V2
+		LineSingle(int __fd, int __pfd, size_t __size, const gpio_v2_line_info& __info) : Line(__fd, __size) {
+			pfd = __pfd;
+			offset_ = __info.offset;
+			name_ = __info.name;
+			label_ = __info.consumer;
+		}
+#endif
+
 		LineSingle(const LineSingle& other) {
 			fd = dup(other.fd);
 			size = other.size;
 			pfd = other.pfd;
+			offset_ = other.offset_;
 			name_ = other.name_;
 			label_ = other.label_;
 		}
@@ -220,6 +265,7 @@ namespace YukiWorkshop::GPIO {
 			fd = dup(other.fd);
 			size = other.size;
 			pfd = other.pfd;
+			offset_ = other.offset_;
 			name_ = other.name_;
 			label_ = other.label_;
 
@@ -270,11 +316,71 @@ namespace YukiWorkshop::GPIO {
 		void write(const std::vector<uint8_t>& __values);
 	};
 
+	// Event handle of a single line, for threads waiting on edges themselves
+	// instead of going through Device::run_eventlistener()
+	class LineEvent : public Line {
+	private:
+		uint32_t offset_ = 0;
+	public:
+		LineEvent() = default;
+
+		LineEvent(int __fd, uint32_t __offset) : Line(__fd, 1), offset_(__offset) {}
+
+		LineEvent(const LineEvent& other) : Line(dup(other.fd), other.size), offset_(other.offset_) {}
+
+		LineEvent& operator=(const LineEvent& other) {
+			fd = dup(other.fd);
+			size = other.size;
+			offset_ = other.offset_;
+
+			return *this;
+		}
+
+		uint32_t number() const noexcept {
+			return offset_;
+		}
+
+		int handle() const noexcept {
+			return fd;
+		}
+
+		uint8_t read();
+
+		// Returns false on timeout. Consumes all pending events, the last one is reported.
+		// Timestamps are in nanoseconds of the clock chosen in EventConfig.
+		bool wait(std::chrono::nanoseconds __timeout, EventType *__type = nullptr, uint64_t *__timestamp = nullptr);
+	};
+
 	class Device {
 	private:
+		friend class Reactor;
+
+		// One preallocated slot per line, the epoll data pointer of its event handle.
+		// Dispatch never locks, fd is -1 while the slot is free. busy counts the
+		// dispatches running the handler, it is only replaced once they're done.
+		struct EventSlot {
+			std::atomic<int> fd{-1};
+			std::atomic<uint32_t> busy{0};
+			std::atomic<uint32_t> errors{0};
+			std::function<void(EventType, uint64_t)> handler;
+		};
+
+		// Same for timers, kept in a list so their addresses don't change
+		struct TimerSlot {
+			std::atomic<int> fd{-1};
+			std::atomic<uint32_t> busy{0};
+			std::atomic<uint32_t> errors{0};
+			std::function<void(uint64_t)> handler;
+		};
+
 		int fd = -1;
 		int epfd = -1;
-		bool eventlistener_run = false;
+		std::atomic<bool> eventlistener_stop = false;
+
+		// Wakes the listener for stop and posted tasks
+		int wakefd = -1;
+		std::mutex task_lock;
+		std::vector<std::function<void()>> tasks;
 
 		std::string path_;
 		std::string name_, label_;
@@ -284,10 +390,24 @@ namespace YukiWorkshop::GPIO {
 		std::map<uint32_t, std::string> lines_by_num_;
 		std::map<std::string, uint32_t> lines_by_name_;
 
-		std::unordered_map<int, std::function<void(EventType, uint64_t)>> events_map;
+		std::unique_ptr<EventSlot[]> event_slots;
+		std::list<TimerSlot> timer_slots;
 
 		void get_device_info();
 
+		void wake();
+
+		void run_tasks();
+
+		static void dispatch_timer(TimerSlot *__slot) noexcept;
+
+		EventSlot *find_event_slot(int __event_handle);
+
+		static int dispatch_event(EventSlot *__slot) noexcept;
+
+		int request_event(uint32_t __line_number, LineMode __line_mode, EventMode __event_mode,
+				  const std::string& __label, const EventConfig& __config);
+
 	public:
 		Device() = default;
 
@@ -306,6 +426,12 @@ namespace YukiWorkshop::GPIO {
 				close(fd);
 			if (epfd > 0)
 				close(epfd);
+			if (wakefd > 0)
+				close(wakefd);
+			for (auto &it : timer_slots) {
+				if (it.fd >= 0)
+					close(it.fd);
+			}
 		}
 
 		Device& operator=(const Device& other) {
@@ -342,21 +468,122 @@ namespace YukiWorkshop::GPIO {
 		LineSingle line(uint32_t __line_number, LineMode __mode, uint8_t __default_value = 0, const std::string& __label = "");
 		LineMultiple line(const std::initializer_list<LineSpec>& __lss, LineMode __mode, const std::string& __label = "");
 
+		LineEvent line_event(uint32_t __line_number, LineMode __line_mode, EventMode __event_mode, const std::string& __label = "",
+				     const EventConfig& __config = {});
+
+		// Handlers should not throw: what they throw is counted in event_errors() and dropped.
+		// A line removed while its handler runs is only added again once it returns,
+		// from within that handler post() it.
 		int add_event(uint32_t __line_number, LineMode __line_mode, EventMode __event_mode,
-			      const std::function<void(EventType, uint64_t)>& __handler, const std::string& __label = "");
+			      const std::function<void(EventType, uint64_t)>& __handler, const std::string& __label = "",
+			      const EventConfig& __config = {});
 
 		void remove_event(int __event_handle);
 
-		void process_event(int __event_handle);
+		// Runs the handler for all the events pending on __event_handle.
+		// Returns 0, or a negative errno when the handle is unknown or reading fails.
+		int process_event(int __event_handle);
+
+		// Failed event reads and event handlers that threw since the device was opened
+		uint32_t event_errors() const;
+
+		// Timer handlers that threw
+		uint32_t timer_errors();
 
 		std::vector<int> event_fds();
 
 		bool is_event_fd(int __fd);
 
+		// Runs __task on the listener thread after the events of the current wakeup.
+		// Tasks posted while the listener isn't running wait for the next run_eventlistener().
+		void post(std::function<void()> __task);
+
+		// Calls __handler with the expiration count on the listener thread, first after __first,
+		// then every __interval unless zero. Returns the timer handle. What it throws is counted
+		// in timer_errors() and dropped.
+		int add_timer(std::chrono::nanoseconds __first, std::chrono::nanoseconds __interval,
+			      const std::function<void(uint64_t)>& __handler);
+
+		void remove_timer(int __timer_handle);
+
 		void run_eventlistener();
+
+		// Returns at once, the listener exits after the events of the current wakeup.
+		// A stop issued before the listener got to run is kept, that run returns at once.
 		void stop_eventlistener();
 	};
 
+	// One epoll loop serving the events of many devices, and any other readable fd
+	// such as a LineEvent handle. Handlers run on the thread calling run().
+	class Reactor {
+	private:
+		struct Source {
+			int fd;
+			std::atomic<bool> alive{true};
+			std::function<void(uint32_t)> handler;
+		};
+
+		int epfd = -1;
+		int wakefd = -1;
+		std::atomic<bool> run_ = false;
+		std::thread thread_;
+
+		// The thread in loop(), and the source whose handler it runs
+		std::atomic<std::thread::id> loop_thread_{};
+		std::atomic<Source *> running_{nullptr};
+
+		std::mutex task_lock;
+		std::vector<std::function<void()>> tasks;
+
+		// Sources are reached through epoll_event.data.ptr, removed ones are freed by the loop
+		std::mutex sources_lock;
+		std::unordered_map<int, std::unique_ptr<Source>> sources;
+		std::vector<std::unique_ptr<Source>> removed;
+		std::atomic<bool> removed_pending = false;
+
+		void free_removed();
+
+		void run_tasks();
+
+		void loop();
+
+	public:
+		Reactor();
+
+		Reactor(const Reactor&) = delete;
+		Reactor& operator=(const Reactor&) = delete;
+
+		~Reactor();
+
+		// Registers the event handles added to __dev so far, call it after add_event()
+		void add(Device& __dev);
+
+		// __handler gets the epoll events of __fd
+		void add(int __fd, const std::function<void(uint32_t)>& __handler, uint32_t __events = EPOLLIN);
+
+		void remove(Device& __dev);
+
+		// A handler of __fd running on the loop is waited for, unless called from the loop itself.
+		// Handlers capturing an object can't run anymore once this returns, it may be destroyed.
+		void remove(int __fd);
+
+		// Runs the loop on the calling thread until stop(), pinned to __cpus unless empty
+		void run(const std::vector<int>& __cpus = {});
+
+		// Runs the loop on a thread of its own, SCHED_RR with a non zero __prio
+		void start(const std::vector<int>& __cpus = {}, int __prio = 0);
+
+		// Runs __task on the loop after the events of the current wakeup.
+		// Timers are plain sources: add() a timerfd.
+		void post(std::function<void()> __task);
+
+		void stop();
+	};
+
+	// The clock the kernel stamps events requested with __config with, for comparing with
+	// clock_gettime(). -1 for Hte, whose timestamps come from the hardware.
+	extern clockid_t event_clock_id(const EventConfig& __config = {});
+
 	extern std::vector<Device> all_devices();
 	extern GPIO::Device find_device_by_label(const std::string& __label);
 	extern GPIO::Device find_device_by_name(const std::string& __name);
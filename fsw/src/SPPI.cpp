@@ -174,15 +174,45 @@ void SPPI::transfer(const void *__tx_buf, void *__rx_buf, uint32_t __len, bool _
 		throw std::system_error(errno, std::system_category(), "failed to transfer");
 }
 
-//void SPPI::transfer(std::vector<SPPI_Transfer>& __transfers) {
-//	for (auto &it : __transfers) {
-//		it.speed_hz = max_speed_hz_;
-//		it.bits_per_word = bits_per_word_;
-//	}
-//
-//	if (ioctl(fd, SPI_IOC_MESSAGE(__transfers.size()), __transfers.data()) < 0)
-//		throw std::system_error(errno, std::system_category(), "failed to transfer");
-//}
+void SPPI::transfer(SPPI_Transfer *__transfers, size_t __count) {
+	if (!__count)
+		return;
+
+	for (size_t i=0; i<__count; i++) {
+		__transfers[i].speed_hz = max_speed_hz_;
+		__transfers[i].bits_per_word = bits_per_word_;
+	}
+
+	errno = 0;
+
+	int rc_lock;
+
+	do {
+		rc_lock = flock(fd, LOCK_EX);
+	} while (errno == EINTR);
+
+	if (rc_lock < 0)
+		throw std::system_error(errno, std::system_category(), "failed to lock device");
+
+	if (custom_chip_selector_)
+		custom_chip_selector_(true);
+
+	int rc_ioc = ioctl(fd, SPI_IOC_MESSAGE(__count), __transfers);
+
+	if (custom_chip_selector_)
+		custom_chip_selector_(false);
+
+	do {
+		flock(fd, LOCK_UN);
+	} while (errno == EINTR);
+
+	if (rc_ioc < 0)
+		throw std::system_error(errno, std::system_category(), "failed to transfer");
+}
+
+void SPPI::transfer(std::vector<SPPI_Transfer>& __transfers) {
+	transfer(__transfers.data(), __transfers.size());
+}
 
 void SPPI::send(const void *__tx_buf, uint32_t __len) {
 	if (write_all(fd, __tx_buf, __len) < 0)
@@ -196,12 +226,18 @@ void SPPI::recv(void *__rx_buf, uint32_t __len) {
 
 void
 SPPI::write(const void *__tx_buf, uint32_t __len, bool __cs_change, uint16_t __delay_usecs, uint8_t __word_delay_usecs) {
-	std::vector<uint8_t> discard(__len);
-	transfer(__tx_buf, discard.data(), __len, __cs_change, __delay_usecs, __word_delay_usecs);
+	// spidev discards the received data when rx_buf is NULL
+	transfer(__tx_buf, nullptr, __len, __cs_change, __delay_usecs, __word_delay_usecs);
 }
 
 void SPPI::read(void *__rx_buf, uint32_t __len, uint8_t __pad_value, bool __cs_change, uint16_t __delay_usecs,
 		uint8_t __word_delay_usecs) {
+	// spidev shifts out zeros when tx_buf is NULL
+	if (!__pad_value) {
+		transfer(nullptr, __rx_buf, __len, __cs_change, __delay_usecs, __word_delay_usecs);
+		return;
+	}
+
 	std::vector<uint8_t> whatever(__len, __pad_value);
 	transfer(whatever.data(), __rx_buf, __len, __cs_change, __delay_usecs, __word_delay_usecs);
 }
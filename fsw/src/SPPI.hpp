@@ -35,7 +35,7 @@ namespace YukiWorkshop {
 
 	class SPPI_Transfer : public spi_ioc_transfer {
 	public:
-		SPPI_Transfer(const void *__tx_buf, void *__rx_buf, uint32_t __len, uint16_t __delay_usecs = 0, bool __cs_change = true, uint8_t __word_delay_usecs = 0) {
+		SPPI_Transfer(const void *__tx_buf = nullptr, void *__rx_buf = nullptr, uint32_t __len = 0, uint16_t __delay_usecs = 0, bool __cs_change = true, uint8_t __word_delay_usecs = 0) {
 			memset(this, 0, sizeof(spi_ioc_transfer));
 			len = __len;
 			delay_usecs = __delay_usecs;
@@ -80,6 +80,10 @@ namespace YukiWorkshop {
 		uint16_t transfer(uint16_t data, bool __cs_change = true, uint16_t __delay_usecs = 0, uint8_t __word_delay_usecs = 0);
 		void transfer(const void *__tx_buf, void *__rx_buf, uint32_t __len, bool __cs_change = true, uint16_t __delay_usecs = 0, uint8_t __word_delay_usecs = 0);
 
+		// Submits all transfers as one SPI message (one ioctl). cs_change of the last transfer should be false.
+		void transfer(SPPI_Transfer *__transfers, size_t __count);
+		void transfer(std::vector<SPPI_Transfer>& __transfers);
+
 		void write(const void *__tx_buf, uint32_t __len, bool __cs_change = true, uint16_t __delay_usecs = 0, uint8_t __word_delay_usecs = 0);
 
 		void read(void *__rx_buf, uint32_t __len, uint8_t __pad_value = 0, bool __cs_change = true, uint16_t __delay_usecs = 0, uint8_t __word_delay_usecs = 0);
@@ -109,8 +109,7 @@ void SX128x::SetTx(TickTime_t timeout )
 		SetRangingRole( RADIO_RANGING_ROLE_MASTER );
 	}
 
-	HalPostRx();
-	HalPreTx();
+	HalSetRfPath(RF_PATH_TX);
 	WriteCommand( RADIO_SET_TX, buf, 3 );
 	OperatingMode = MODE_TX;
 }
@@ -133,8 +132,7 @@ void SX128x::SetRx(TickTime_t timeout )
 		SetRangingRole( RADIO_RANGING_ROLE_SLAVE );
 	}
 
-	HalPostTx();
-	HalPreRx();
+	HalSetRfPath(RF_PATH_RX);
 	WriteCommand( RADIO_SET_RX, buf, 3 );
 	OperatingMode = MODE_RX;
 }
@@ -149,8 +147,7 @@ void SX128x::SetRxDutyCycle(RadioTickSizes_t periodBase, uint16_t periodBaseCoun
 	buf[3] = ( uint8_t )( ( periodBaseCountSleep >> 8 ) & 0x00FF );
 	buf[4] = ( uint8_t )( periodBaseCountSleep & 0x00FF );
 
-	HalPostTx();
-	HalPreRx();
+	HalSetRfPath(RF_PATH_RX);
 	WriteCommand( RADIO_SET_RXDUTYCYCLE, buf, 5 );
 	OperatingMode = MODE_RX;
 }
@@ -159,8 +156,7 @@ void SX128x::SetCad(void )
 {
 	std::lock_guard<std::mutex> lg(IOLock2);
 
-	HalPostTx();
-	HalPreRx();
+	HalSetRfPath(RF_PATH_RX);
 	WriteCommand( RADIO_SET_CAD, 0, 0 );
 	OperatingMode = MODE_CAD;
 }
@@ -169,8 +165,7 @@ void SX128x::SetTxContinuousWave(void )
 {
 	std::lock_guard<std::mutex> lg(IOLock2);
 
-	HalPostRx();
-	HalPreTx();
+	HalSetRfPath(RF_PATH_TX);
 	WriteCommand( RADIO_SET_TXCONTINUOUSWAVE, 0, 0 );
 }
 
@@ -178,8 +173,7 @@ void SX128x::SetTxContinuousPreamble(void )
 {
 	std::lock_guard<std::mutex> lg(IOLock2);
 
-	HalPostRx();
-	HalPreTx();
+	HalSetRfPath(RF_PATH_TX);
 	WriteCommand( RADIO_SET_TXCONTINUOUSPREAMBLE, 0, 0 );
 }
 
@@ -245,6 +239,9 @@ void SX128x::SetBufferBaseAddresses(uint8_t txBaseAddress, uint8_t rxBaseAddress
 	buf[0] = txBaseAddress;
 	buf[1] = rxBaseAddress;
 	WriteCommand( RADIO_SET_BUFFERBASEADDRESS, buf, 2 );
+
+	TxBaseAddress = txBaseAddress;
+	RxBaseAddress = rxBaseAddress;
 }
 
 void SX128x::SetModulationParams(const ModulationParams_t& modParams )
@@ -302,55 +299,7 @@ void SX128x::SetPacketParams(const PacketParams_t& packetParams)
 		this->SetPacketType( packetParams.PacketType );
 	}
 
-	switch( packetParams.PacketType )
-	{
-		case PACKET_TYPE_GFSK:
-			buf[0] = packetParams.Params.Gfsk.PreambleLength;
-			buf[1] = packetParams.Params.Gfsk.SyncWordLength;
-			buf[2] = packetParams.Params.Gfsk.SyncWordMatch;
-			buf[3] = packetParams.Params.Gfsk.HeaderType;
-			buf[4] = packetParams.Params.Gfsk.PayloadLength;
-			buf[5] = packetParams.Params.Gfsk.CrcLength;
-			buf[6] = packetParams.Params.Gfsk.Whitening;
-			break;
-		case PACKET_TYPE_LORA:
-		case PACKET_TYPE_RANGING:
-			buf[0] = packetParams.Params.LoRa.PreambleLength;
-			buf[1] = packetParams.Params.LoRa.HeaderType;
-			buf[2] = packetParams.Params.LoRa.PayloadLength;
-			buf[3] = packetParams.Params.LoRa.Crc;
-			buf[4] = packetParams.Params.LoRa.InvertIQ;
-			buf[5] = 0;
-			buf[6] = 0;
-			break;
-		case PACKET_TYPE_FLRC:
-			buf[0] = packetParams.Params.Flrc.PreambleLength;
-			buf[1] = packetParams.Params.Flrc.SyncWordLength;
-			buf[2] = packetParams.Params.Flrc.SyncWordMatch;
-			buf[3] = packetParams.Params.Flrc.HeaderType;
-			buf[4] = packetParams.Params.Flrc.PayloadLength;
-			buf[5] = packetParams.Params.Flrc.CrcLength;
-			buf[6] = packetParams.Params.Flrc.Whitening;
-			break;
-		case PACKET_TYPE_BLE:
-			buf[0] = packetParams.Params.Ble.ConnectionState;
-			buf[1] = packetParams.Params.Ble.CrcLength;
-			buf[2] = packetParams.Params.Ble.BleTestPayload;
-			buf[3] = packetParams.Params.Ble.Whitening;
-			buf[4] = 0;
-			buf[5] = 0;
-			buf[6] = 0;
-			break;
-		case PACKET_TYPE_NONE:
-			buf[0] = 0;
-			buf[1] = 0;
-			buf[2] = 0;
-			buf[3] = 0;
-			buf[4] = 0;
-			buf[5] = 0;
-			buf[6] = 0;
-			break;
-	}
+	EncodePacketParams( packetParams, buf );
 	WriteCommand( RADIO_SET_PACKETPARAMS, buf, 7 );
 	CurrentPacketParams = packetParams;
 }
@@ -392,7 +341,12 @@ void SX128x::GetPacketStatus(PacketStatus_t *packetStatus )
 
 	ReadCommand( RADIO_GET_PACKETSTATUS, status, 5 );
 
-	packetStatus->packetType = this -> GetPacketType( true );
+	DecodePacketStatus( this -> GetPacketType( true ), status, packetStatus );
+}
+
+void SX128x::DecodePacketStatus(RadioPacketTypes_t packetType, const uint8_t *status, PacketStatus_t *packetStatus )
+{
+	packetStatus->packetType = packetType;
 	switch( packetStatus->packetType )
 	{
 		case PACKET_TYPE_GFSK:
@@ -462,6 +416,129 @@ void SX128x::GetPacketStatus(PacketStatus_t *packetStatus )
 	}
 }
 
+void SX128x::ServiceIrqs(RxCompletion_t &rx, uint8_t prefetch )
+{
+	ServiceIrqs( rx, prefetch, 0 );
+}
+
+void SX128x::ServiceIrqs(RxCompletion_t &rx, uint8_t prefetch, uint16_t leave )
+{
+	enum {
+		SEG_IRQ,
+		SEG_CLEAR,
+		SEG_BUFFER_STATUS,
+		SEG_PACKET_STATUS,
+		SEG_LORA_REGS,
+		SEG_PAYLOAD,
+		SEG_MAX
+	};
+
+	// Command bytes, zeros are clocked out for the responses
+	uint8_t irqOut[4] = { RADIO_GET_IRQSTATUS, 0, 0, 0 };
+	uint16_t clearMask = IRQ_RADIO_ALL & ~leave;
+	uint8_t clearOut[3] = { RADIO_CLR_IRQSTATUS, ( uint8_t )( clearMask >> 8 ), ( uint8_t )( clearMask & 0xFF ) };
+	uint8_t bufferOut[4] = { RADIO_GET_RXBUFFERSTATUS, 0, 0, 0 };
+	uint8_t packetOut[7] = { RADIO_GET_PACKETSTATUS, 0, 0, 0, 0, 0, 0 };
+	// REG_LR_PAYLOADLENGTH up to REG_LR_PACKETPARAMS
+	uint8_t loraOut[7] = { RADIO_READ_REGISTER, ( REG_LR_PAYLOADLENGTH >> 8 ) & 0xFF, REG_LR_PAYLOADLENGTH & 0xFF, 0, 0, 0, 0 };
+	uint8_t payloadOut[3 + 255] = { RADIO_READ_BUFFER, 0, 0 };
+
+	uint8_t irqIn[4], bufferIn[4], packetIn[7], loraIn[7], payloadIn[3 + 255];
+
+	SpiSegment_t segments[SEG_MAX];
+	size_t count = 0;
+
+	std::lock_guard<std::mutex> lg2(IOLock2);
+
+	RadioPacketTypes_t packetType = GetPacketType( true );
+
+	segments[count++] = { irqIn, irqOut, sizeof(irqOut), BatchDelay( irqOut[0] ) };
+	segments[count++] = { nullptr, clearOut, sizeof(clearOut), BatchDelay( clearOut[0] ) };
+	segments[count++] = { bufferIn, bufferOut, sizeof(bufferOut), BatchDelay( bufferOut[0] ) };
+	segments[count++] = { packetIn, packetOut, sizeof(packetOut), BatchDelay( packetOut[0] ) };
+
+	if (packetType == PACKET_TYPE_LORA)
+		segments[count++] = { loraIn, loraOut, sizeof(loraOut), BatchDelay( loraOut[0] ) };
+
+	// A reception starts at the Rx base address, so the payload can be read before its length is known
+	if (prefetch) {
+		payloadOut[1] = RxBaseAddress;
+		segments[count++] = { payloadIn, payloadOut, static_cast<uint16_t>(3 + prefetch), BatchDelay( payloadOut[0] ) };
+	}
+
+	// The trailing BUSY period is covered by the poll below
+	segments[count-1].delay_usecs = 0;
+
+	{
+		std::lock_guard<std::mutex> lg(IOLock);
+
+		WaitOnBusyUnlessIdle();
+
+		HalSpiTransferBatch(segments, count);
+
+		WaitOnBusy(static_cast<RadioCommands_t>(segments[count-1].buffer_out[0]));
+	}
+
+	HalIrqStage(IRQ_STAGE_STATUS_READ);
+
+	rx.IrqRegs = ( ( irqIn[2] << 8 ) | irqIn[3] ) & clearMask;
+	rx.Offset = bufferIn[3];
+
+	// Same rules as GetRxBufferStatus( )
+	if (packetType == PACKET_TYPE_LORA && ( loraIn[6] >> 7 ) == 1)
+		rx.Length = loraIn[4];
+	else if (packetType == PACKET_TYPE_BLE)
+		rx.Length = bufferIn[2] + 2;
+	else
+		rx.Length = bufferIn[2];
+
+	DecodePacketStatus( packetType, packetIn + 2, &rx.PacketStatus );
+
+	switch( packetType )
+	{
+		case PACKET_TYPE_LORA:
+		case PACKET_TYPE_RANGING:
+			rx.Rssi = rx.PacketStatus.LoRa.RssiPkt;
+			rx.Snr = rx.PacketStatus.LoRa.SnrPkt;
+			break;
+		case PACKET_TYPE_GFSK:
+			rx.Rssi = rx.PacketStatus.Gfsk.RssiSync;
+			rx.Snr = 0;
+			break;
+		case PACKET_TYPE_FLRC:
+			rx.Rssi = rx.PacketStatus.Flrc.RssiSync;
+			rx.Snr = 0;
+			break;
+		case PACKET_TYPE_BLE:
+			rx.Rssi = rx.PacketStatus.Ble.RssiSync;
+			rx.Snr = 0;
+			break;
+		default:
+			rx.Rssi = 0;
+			rx.Snr = 0;
+			break;
+	}
+
+	if (( rx.IrqRegs & IRQ_RX_DONE ) != IRQ_RX_DONE)
+	{
+		rx.Length = 0;
+		return;
+	}
+
+	if (prefetch && rx.Offset == RxBaseAddress && rx.Length <= prefetch)
+	{
+		memcpy( rx.Payload, payloadIn + 3, rx.Length );
+	}
+	else
+	{
+		// Didn't fit the prefetch, read the rest in a second transaction
+		uint8_t done = ( prefetch && rx.Offset == RxBaseAddress ) ? prefetch : 0;
+
+		memcpy( rx.Payload, payloadIn + 3, done );
+		ReadBuffer( rx.Offset + done, rx.Payload + done, rx.Length - done );
+	}
+}
+
 int8_t SX128x::GetRssiInst(void )
 {
 	uint8_t raw = 0;
@@ -484,6 +561,119 @@ void SX128x::SetDioIrqParams(uint16_t irqMask, uint16_t dio1Mask, uint16_t dio2M
 	buf[6] = ( uint8_t )( ( dio3Mask >> 8 ) & 0x00FF );
 	buf[7] = ( uint8_t )( dio3Mask & 0x00FF );
 	WriteCommand( RADIO_SET_DIOIRQPARAMS, buf, 8 );
+
+	// A wired line carrying a single self-contained IRQ tells its cause by itself
+	uint16_t masks[3] = { ( uint16_t )( dio1Mask & irqMask ), ( uint16_t )( dio2Mask & irqMask ), ( uint16_t )( dio3Mask & irqMask ) };
+	uint8_t lines = HalDioLines();
+	uint16_t fast = 0;
+
+	for (int i = 0; i < 3; i++)
+	{
+		DioMasks[i] = masks[i];
+
+		if (( lines & ( 1 << i ) ) && ( masks[i] & IRQ_DIO_FAST_MASK ) && !( masks[i] & ( masks[i] - 1 ) ))
+			fast |= masks[i];
+	}
+
+	DioFastMask = fast;
+}
+
+SX128x::DioPlan_t SX128x::PlanDioIrqs(uint16_t irqMask, uint8_t dioLines )
+{
+	// Most latency critical first
+	static const uint16_t dedicated[] = { IRQ_TX_DONE, IRQ_RX_TX_TIMEOUT };
+
+	DioPlan_t plan = { { 0, 0, 0 } };
+	uint8_t lines[3];
+	uint8_t count = 0;
+
+	for (uint8_t i = 0; i < 3; i++)
+	{
+		if (dioLines & ( 1 << i ))
+			lines[count++] = i;
+	}
+
+	if (!count)
+		return plan;
+
+	// The last wired line carries everything not given a line of its own
+	uint16_t rest = irqMask;
+	uint8_t next = 0;
+
+	for (uint16_t irq : dedicated)
+	{
+		if (next + 1 >= count)
+			break;
+
+		if (irqMask & irq)
+		{
+			plan.Dio[lines[next++]] = irq;
+			rest &= ~irq;
+		}
+	}
+
+	plan.Dio[lines[count - 1]] = rest;
+
+	return plan;
+}
+
+void SX128x::SetDioIrqRouting(uint16_t irqMask )
+{
+	DioPlan_t plan = PlanDioIrqs( irqMask, HalDioLines() );
+
+	SetDioIrqParams( irqMask, plan.Dio[0], plan.Dio[1], plan.Dio[2] );
+}
+
+void SX128x::ProcessDioIrq(GpioPinFunction_t dio )
+{
+	int line = dio - GPIO_PIN_DIO1;
+	uint16_t irqRegs = ( line >= 0 && line < 3 ) ? DioMasks[line] : 0;
+
+	if (!irqRegs || ( irqRegs & ~DioFastMask ))
+	{
+		// The lines of their own serve their IRQs
+		ProcessIrqsExcept( DioFastMask );
+		return;
+	}
+
+	// The line identifies the IRQ: it's read and cleared in one batch, without the
+	// packet type and buffer reads, and only dispatched when actually raised
+	uint8_t irqOut[4] = { RADIO_GET_IRQSTATUS, 0, 0, 0 };
+	uint8_t clearOut[3] = { RADIO_CLR_IRQSTATUS, ( uint8_t )( irqRegs >> 8 ), ( uint8_t )( irqRegs & 0xFF ) };
+	uint8_t irqIn[4];
+
+	SpiSegment_t segments[2] = {
+		{ irqIn, irqOut, sizeof(irqOut), BatchDelay( irqOut[0] ) },
+		{ nullptr, clearOut, sizeof(clearOut), 0 }
+	};
+
+	{
+		std::lock_guard<std::mutex> lg2(IOLock2);
+		std::lock_guard<std::mutex> lg(IOLock);
+
+		WaitOnBusyUnlessIdle();
+
+		HalSpiTransferBatch(segments, 2);
+
+		WaitOnBusy(RADIO_CLR_IRQSTATUS);
+	}
+
+	HalIrqStage( IRQ_STAGE_STATUS_READ );
+
+	// A stale or spurious edge
+	irqRegs &= ( irqIn[2] << 8 ) | irqIn[3];
+
+	if (!irqRegs)
+		return;
+
+	CallbackListener<decltype(callbacks)> listener{{}, callbacks};
+	const IrqRule_t *rules = IrqRules(PacketType, OperatingMode);
+
+	DispatchIrqs(listener, rules, irqRegs, AdvanceStreams(irqRegs));
+
+#if SX128X_HAS_COROUTINES
+	ResumeRadioOp(irqRegs);
+#endif
 }
 
 uint16_t SX128x::GetIrqStatus(void )
@@ -573,6 +763,448 @@ void SX128x::SendPayload(uint8_t *payload, uint8_t size, TickTime_t timeout, uin
 	SetTx( timeout );
 }
 
+void SX128x::EncodePacketParams(const PacketParams_t &packetParams, uint8_t *buf )
+{
+	switch( packetParams.PacketType )
+	{
+		case PACKET_TYPE_GFSK:
+			buf[0] = packetParams.Params.Gfsk.PreambleLength;
+			buf[1] = packetParams.Params.Gfsk.SyncWordLength;
+			buf[2] = packetParams.Params.Gfsk.SyncWordMatch;
+			buf[3] = packetParams.Params.Gfsk.HeaderType;
+			buf[4] = packetParams.Params.Gfsk.PayloadLength;
+			buf[5] = packetParams.Params.Gfsk.CrcLength;
+			buf[6] = packetParams.Params.Gfsk.Whitening;
+			break;
+		case PACKET_TYPE_LORA:
+		case PACKET_TYPE_RANGING:
+			buf[0] = packetParams.Params.LoRa.PreambleLength;
+			buf[1] = packetParams.Params.LoRa.HeaderType;
+			buf[2] = packetParams.Params.LoRa.PayloadLength;
+			buf[3] = packetParams.Params.LoRa.Crc;
+			buf[4] = packetParams.Params.LoRa.InvertIQ;
+			buf[5] = 0;
+			buf[6] = 0;
+			break;
+		case PACKET_TYPE_FLRC:
+			buf[0] = packetParams.Params.Flrc.PreambleLength;
+			buf[1] = packetParams.Params.Flrc.SyncWordLength;
+			buf[2] = packetParams.Params.Flrc.SyncWordMatch;
+			buf[3] = packetParams.Params.Flrc.HeaderType;
+			buf[4] = packetParams.Params.Flrc.PayloadLength;
+			buf[5] = packetParams.Params.Flrc.CrcLength;
+			buf[6] = packetParams.Params.Flrc.Whitening;
+			break;
+		case PACKET_TYPE_BLE:
+			buf[0] = packetParams.Params.Ble.ConnectionState;
+			buf[1] = packetParams.Params.Ble.CrcLength;
+			buf[2] = packetParams.Params.Ble.BleTestPayload;
+			buf[3] = packetParams.Params.Ble.Whitening;
+			buf[4] = 0;
+			buf[5] = 0;
+			buf[6] = 0;
+			break;
+		case PACKET_TYPE_NONE:
+			buf[0] = 0;
+			buf[1] = 0;
+			buf[2] = 0;
+			buf[3] = 0;
+			buf[4] = 0;
+			buf[5] = 0;
+			buf[6] = 0;
+			break;
+	}
+}
+
+void SX128x::StartTxStream(TickTime_t timeout )
+{
+	StartTxStream( timeout, false, {} );
+}
+
+void SX128x::StartTxStream(TickTime_t timeout, TickTime_t idleRxTimeout )
+{
+	StartTxStream( timeout, true, idleRxTimeout );
+}
+
+void SX128x::StartTxStream(TickTime_t timeout, bool idleRx, TickTime_t idleRxTimeout )
+{
+	std::lock_guard<std::mutex> lg(TxStreamLock);
+
+	// Restarted before the last frame completed, the base to restore is already kept
+	if (!TxStreamActive && TxOnAir < 0)
+		TxStreamBase = TxBaseAddress;
+
+	TxStreamActive = true;
+	TxStreamTimeout = timeout;
+	TxStreamIdleRx = idleRx;
+	TxStreamRxTimeout = idleRxTimeout;
+	TxReady = -1;
+
+	if (idleRx && TxOnAir < 0)
+		SetRx( idleRxTimeout );
+}
+
+bool SX128x::QueueTx(const uint8_t *payload, uint8_t size )
+{
+	if (size > TX_STREAM_MAX_SIZE)
+		throw std::length_error("frame larger than a Tx stream half");
+
+	std::unique_lock<std::mutex> lk(TxStreamLock);
+
+	if (!TxStreamActive)
+		throw std::logic_error("Tx stream not started");
+
+	if (TxReady >= 0 || TxUploading)
+		return false;
+
+	uint8_t half = TxOnAir >= 0 ? 1 - TxOnAir : 0;
+	TxUploading = true;
+
+	// Uploaded unlocked, so a TxDone meanwhile doesn't hold up the IRQ servicing.
+	// It finds nothing ready and the frame is started below instead.
+	{
+		// Relocks and clears the flag even when the upload throws
+		struct UploadGuard {
+			std::unique_lock<std::mutex> &lk;
+			bool &uploading;
+
+			~UploadGuard() {
+				lk.lock();
+				uploading = false;
+			}
+		} guard{lk, TxUploading};
+
+		lk.unlock();
+		WriteBuffer( half * TX_STREAM_MAX_SIZE, const_cast<uint8_t *>( payload ), size );
+	}
+
+	if (!TxStreamActive)
+		throw std::logic_error("Tx stream stopped during the upload");
+
+	if (TxOnAir < 0)
+		StartStreamTx( half, size, true );
+	else
+	{
+		TxReady = half;
+		TxReadySize = size;
+	}
+
+	return true;
+}
+
+uint8_t SX128x::GetTxStreamDepth(void )
+{
+	std::lock_guard<std::mutex> lg(TxStreamLock);
+
+	return ( TxOnAir >= 0 ) + ( TxReady >= 0 );
+}
+
+void SX128x::StopTxStream(void )
+{
+	std::lock_guard<std::mutex> lg(TxStreamLock);
+
+	TxStreamActive = false;
+	TxReady = -1;
+
+	// Otherwise when the frame on air completes
+	if (TxOnAir < 0)
+		RestoreTxBase();
+}
+
+// Call with TxStreamLock held
+void SX128x::RestoreTxBase(void )
+{
+	if (TxBaseAddress != TxStreamBase)
+		SetBufferBaseAddresses( TxStreamBase, RxBaseAddress );
+}
+
+// Call with TxStreamLock held
+void SX128x::StartStreamTx(uint8_t half, uint8_t size, bool fresh )
+{
+	uint8_t clearOut[3] = { RADIO_CLR_IRQSTATUS, ( uint8_t )( IRQ_RADIO_ALL >> 8 ), ( uint8_t )( IRQ_RADIO_ALL & 0xFF ) };
+	uint8_t roleOut[2] = { RADIO_SET_RANGING_ROLE, RADIO_RANGING_ROLE_MASTER };
+	uint8_t baseOut[3] = { RADIO_SET_BUFFERBASEADDRESS, ( uint8_t )( half * TX_STREAM_MAX_SIZE ), RxBaseAddress };
+	uint8_t paramsOut[8] = { RADIO_SET_PACKETPARAMS };
+	uint8_t txOut[4] = { RADIO_SET_TX, TxStreamTimeout.PeriodBase,
+			     ( uint8_t )( ( TxStreamTimeout.PeriodBaseCount >> 8 ) & 0x00FF ),
+			     ( uint8_t )( TxStreamTimeout.PeriodBaseCount & 0x00FF ) };
+
+	SpiSegment_t segments[5];
+	size_t count = 0;
+
+	std::lock_guard<std::mutex> lg2(IOLock2);
+
+	// What SetTx( ) does first. Not when chained from TxDone, whose IRQs are still being served.
+	if (fresh)
+	{
+		segments[count++] = { nullptr, clearOut, sizeof(clearOut), BatchDelay( clearOut[0] ) };
+
+		if (PacketType == PACKET_TYPE_RANGING)
+			segments[count++] = { nullptr, roleOut, sizeof(roleOut), BatchDelay( roleOut[0] ) };
+	}
+
+	segments[count++] = { nullptr, baseOut, sizeof(baseOut), BatchDelay( baseOut[0] ) };
+
+	// The payload length only needs a write when it changes
+	PacketParams_t params = CurrentPacketParams;
+	uint8_t *length = nullptr;
+
+	switch( params.PacketType )
+	{
+		case PACKET_TYPE_GFSK:
+			length = &params.Params.Gfsk.PayloadLength;
+			break;
+		case PACKET_TYPE_LORA:
+		case PACKET_TYPE_RANGING:
+			length = &params.Params.LoRa.PayloadLength;
+			break;
+		case PACKET_TYPE_FLRC:
+			length = &params.Params.Flrc.PayloadLength;
+			break;
+		default:
+			break;
+	}
+
+	if (length && *length != size)
+	{
+		*length = size;
+		EncodePacketParams( params, paramsOut + 1 );
+		segments[count++] = { nullptr, paramsOut, sizeof(paramsOut), BatchDelay( paramsOut[0] ) };
+	}
+
+	segments[count++] = { nullptr, txOut, sizeof(txOut), 0 };
+
+	HalSetRfPath(RF_PATH_TX);
+
+	{
+		std::lock_guard<std::mutex> lg(IOLock);
+
+		WaitOnBusyUnlessIdle();
+
+		HalSpiTransferBatch(segments, count);
+
+		WaitOnBusy(RADIO_SET_TX);
+	}
+
+	CurrentPacketParams = params;
+	OperatingMode = MODE_TX;
+	TxBaseAddress = baseOut[1];
+	TxOnAir = half;
+}
+
+bool SX128x::TxStreamNext(void )
+{
+	std::lock_guard<std::mutex> lg(TxStreamLock);
+
+	if (TxOnAir < 0)
+		return false;
+
+	TxOnAir = -1;
+
+	if (TxReady < 0)
+	{
+		if (!TxStreamActive)
+		{
+			RestoreTxBase();
+			return false;
+		}
+
+		if (!TxStreamIdleRx)
+			return false;
+
+		// Under the stream lock, so a QueueTx( ) can't start a frame this would abort
+		SetRx( TxStreamRxTimeout );
+		return true;
+	}
+
+	uint8_t half = TxReady;
+	TxReady = -1;
+	StartStreamTx( half, TxReadySize, false );
+
+	return true;
+}
+
+void SX128x::StartContinuousRx(uint8_t maxSize )
+{
+	if (!maxSize || maxSize > 128)
+		throw std::length_error("continuous Rx needs at least two slots");
+
+	{
+		std::lock_guard<std::mutex> lg(RxcLock);
+
+		RxcSlots = std::min( 256 / maxSize, 8 );
+		RxcSlotSize = 256 / RxcSlots;
+		RxcSlot = 0;
+		RxcHead = 0;
+		RxcCount = 0;
+		RxcOverruns = 0;
+		RxcOversized = 0;
+		RxcActive = true;
+	}
+
+	// Longer packets are then refused by the radio itself. A LoRa header carries
+	// its own length, those are caught in ContinuousRxNext( ).
+	if (( PacketType == PACKET_TYPE_GFSK && CurrentPacketParams.Params.Gfsk.HeaderType == RADIO_PACKET_VARIABLE_LENGTH ) ||
+	    ( PacketType == PACKET_TYPE_FLRC && CurrentPacketParams.Params.Flrc.HeaderType == RADIO_PACKET_VARIABLE_LENGTH ))
+		SetPacketParams( WithPayloadLength( maxSize ) );
+
+	SetBufferBaseAddresses( TxBaseAddress, 0 );
+	SetRx( RX_TX_CONTINUOUS );
+}
+
+bool SX128x::ReadContinuousRx(uint8_t *payload, uint8_t maxSize, uint8_t *size, PacketStatus_t *packetStatus )
+{
+	// Held during the read, so the slot can't be rotated into meanwhile
+	std::lock_guard<std::mutex> lg(RxcLock);
+
+	if (!RxcCount)
+		return false;
+
+	ContinuousRxPacket_t &pkt = RxcQueue[RxcHead];
+
+	ReadBuffer( pkt.Offset, payload, std::min( pkt.Length, maxSize ) );
+	*size = pkt.Length;
+	if (packetStatus)
+		*packetStatus = pkt.PacketStatus;
+
+	RxcHead = ( RxcHead + 1 ) % RxcSlots;
+	RxcCount--;
+
+	return true;
+}
+
+uint8_t SX128x::GetContinuousRxPending(void )
+{
+	std::lock_guard<std::mutex> lg(RxcLock);
+
+	return RxcCount;
+}
+
+uint32_t SX128x::GetContinuousRxOverruns(void )
+{
+	std::lock_guard<std::mutex> lg(RxcLock);
+
+	return RxcOverruns;
+}
+
+void SX128x::StopContinuousRx(void )
+{
+	{
+		std::lock_guard<std::mutex> lg(RxcLock);
+
+		RxcActive = false;
+		RxcCount = 0;
+	}
+
+	SetStandby( STDBY_RC );
+}
+
+uint32_t SX128x::GetContinuousRxOversized(void )
+{
+	std::lock_guard<std::mutex> lg(RxcLock);
+
+	return RxcOversized;
+}
+
+bool SX128x::AdvanceStreams(uint16_t irqRegs )
+{
+	// Frees the slot the radio writes to before the handlers read the packet
+	if (irqRegs & IRQ_RX_DONE)
+		ContinuousRxNext(irqRegs);
+
+	// A streamed frame waiting is started before anything else
+	if (OperatingMode == MODE_TX && ( irqRegs & ( IRQ_TX_DONE | IRQ_RX_TX_TIMEOUT ) ))
+		return TxStreamNext();
+
+	return false;
+}
+
+void SX128x::ContinuousRxNext(uint16_t irqRegs )
+{
+	std::lock_guard<std::mutex> lg(RxcLock);
+
+	if (!RxcActive)
+		return;
+
+	// A broken packet is simply overwritten by the next one
+	if (irqRegs & ( IRQ_CRC_ERROR | IRQ_HEADER_ERROR | IRQ_SYNCWORD_ERROR ))
+		return;
+
+	// The slot after the one written is the oldest waiting when all are full
+	uint8_t next = ( RxcSlot + 1 ) % RxcSlots;
+
+	if (RxcCount == RxcSlots - 1)
+	{
+		RxcHead = ( RxcHead + 1 ) % RxcSlots;
+		RxcCount--;
+		RxcOverruns++;
+	}
+
+	uint8_t bufferOut[4] = { RADIO_GET_RXBUFFERSTATUS, 0, 0, 0 };
+	uint8_t packetOut[7] = { RADIO_GET_PACKETSTATUS, 0, 0, 0, 0, 0, 0 };
+	uint8_t loraOut[7] = { RADIO_READ_REGISTER, ( REG_LR_PAYLOADLENGTH >> 8 ) & 0xFF, REG_LR_PAYLOADLENGTH & 0xFF, 0, 0, 0, 0 };
+	uint8_t baseOut[3] = { RADIO_SET_BUFFERBASEADDRESS, TxBaseAddress, ( uint8_t )( next * RxcSlotSize ) };
+
+	uint8_t bufferIn[4], packetIn[7], loraIn[7];
+
+	SpiSegment_t segments[4];
+	size_t count = 0;
+
+	std::lock_guard<std::mutex> lg2(IOLock2);
+
+	RadioPacketTypes_t packetType = GetPacketType( true );
+
+	segments[count++] = { bufferIn, bufferOut, sizeof(bufferOut), BatchDelay( bufferOut[0] ) };
+	segments[count++] = { packetIn, packetOut, sizeof(packetOut), BatchDelay( packetOut[0] ) };
+
+	if (packetType == PACKET_TYPE_LORA)
+		segments[count++] = { loraIn, loraOut, sizeof(loraOut), BatchDelay( loraOut[0] ) };
+
+	segments[count++] = { nullptr, baseOut, sizeof(baseOut), 0 };
+
+	{
+		std::lock_guard<std::mutex> lg3(IOLock);
+
+		WaitOnBusyUnlessIdle();
+
+		HalSpiTransferBatch(segments, count);
+
+		WaitOnBusy(RADIO_SET_BUFFERBASEADDRESS);
+	}
+
+	RxBaseAddress = baseOut[2];
+	RxcSlot = next;
+
+	ContinuousRxPacket_t &pkt = RxcQueue[( RxcHead + RxcCount ) % RxcSlots];
+
+	// Same rules as GetRxBufferStatus( )
+	pkt.Offset = bufferIn[3];
+	if (packetType == PACKET_TYPE_LORA && ( loraIn[6] >> 7 ) == 1)
+		pkt.Length = loraIn[4];
+	else if (packetType == PACKET_TYPE_BLE)
+		pkt.Length = bufferIn[2] + 2;
+	else
+		pkt.Length = bufferIn[2];
+
+	if (pkt.Length > RxcSlotSize)
+	{
+		// Spilled over the slots after its own: dropped, along with the queued ones it overwrote
+		uint8_t spilled = ( pkt.Length - 1 ) / RxcSlotSize;
+		uint8_t free = RxcSlots - 1 - RxcCount;
+		uint8_t hit = spilled > free ? std::min<uint8_t>( spilled - free, RxcCount ) : 0;
+
+		RxcHead = ( RxcHead + hit ) % RxcSlots;
+		RxcCount -= hit;
+		RxcOverruns += hit;
+		RxcOversized++;
+		return;
+	}
+
+	DecodePacketStatus( packetType, packetIn + 2, &pkt.PacketStatus );
+
+	RxcCount++;
+}
+
 uint8_t SX128x::SetSyncWord(uint8_t syncWordIdx, uint8_t *syncWord )
 {
 	uint16_t addr;
@@ -788,6 +1420,7 @@ void SX128x::SetRangingRequestAddress(uint32_t address )
 double SX128x::GetRangingResult(RadioRangingResultTypes_t resultType )
 {
 	uint32_t valLsb = 0;
+	uint8_t valRaw[3] = {0};
 	double val = 0.0;
 
 	switch( GetPacketType( true ) )
@@ -796,7 +1429,8 @@ double SX128x::GetRangingResult(RadioRangingResultTypes_t resultType )
 			this->SetStandby( STDBY_XOSC );
 			this->WriteRegister( 0x97F, this->ReadRegister( 0x97F ) | ( 1 << 1 ) ); // enable LORA modem clock
 			WriteRegister( REG_LR_RANGINGRESULTCONFIG, ( ReadRegister( REG_LR_RANGINGRESULTCONFIG ) & MASK_RANGINGMUXSEL ) | ( ( ( ( uint8_t )resultType ) & 0x03 ) << 4 ) );
-			valLsb = ( ( ReadRegister( REG_LR_RANGINGRESULTBASEADDR ) << 16 ) | ( ReadRegister( REG_LR_RANGINGRESULTBASEADDR + 1 ) << 8 ) | ( ReadRegister( REG_LR_RANGINGRESULTBASEADDR + 2 ) ) );
+			ReadRegister( REG_LR_RANGINGRESULTBASEADDR, valRaw, 3 );
+			valLsb = ( ( valRaw[0] << 16 ) | ( valRaw[1] << 8 ) | valRaw[2] );
 			this->SetStandby( STDBY_RC );
 
 			// Convertion from LSB to distance. For explanation on the formula, refer to Datasheet of SX1280
@@ -880,9 +1514,7 @@ double SX128x::GetFrequencyError( )
 	{
 		case PACKET_TYPE_LORA:
 		case PACKET_TYPE_RANGING:
-			efeRaw[0] = this->ReadRegister( REG_LR_ESTIMATED_FREQUENCY_ERROR_MSB );
-			efeRaw[1] = this->ReadRegister( REG_LR_ESTIMATED_FREQUENCY_ERROR_MSB + 1 );
-			efeRaw[2] = this->ReadRegister( REG_LR_ESTIMATED_FREQUENCY_ERROR_MSB + 2 );
+			this->ReadRegister( REG_LR_ESTIMATED_FREQUENCY_ERROR_MSB, efeRaw, 3 );
 			efe = ( efeRaw[0]<<16 ) | ( efeRaw[1]<<8 ) | efeRaw[2];
 			efe &= REG_LR_ESTIMATED_FREQUENCY_ERROR_MASK;
 
@@ -962,267 +1594,439 @@ int32_t SX128x::GetLoRaBandwidth( )
 //	}
 //}
 
-void SX128x::ProcessIrqs() {
-	std::unique_lock<std::mutex> lg(IOLock2);
+uint16_t SX128x::FetchIrqs(RadioPacketTypes_t &packetType, uint16_t leave) {
+	std::lock_guard<std::mutex> lg(IOLock2);
+
+//	if (this->PollingMode == true )
+//	{
+//		if (this->IrqState == true )
+//		{
+////            __disable_irq();
+//			this->IrqState = false;
+////            __enable_irq();
+//		}
+//		else
+//		{
+//			return;
+//		}
+//	}
+
+	packetType = GetPacketType( true );
+	uint16_t irqRegs = GetIrqStatus();
+
+	ClearIrqStatus( IRQ_RADIO_ALL & ~leave );
+
+	HalIrqStage( IRQ_STAGE_STATUS_READ );
+
+	return irqRegs & ~leave;
+}
+
+const SX128x::IrqRule_t *SX128x::IrqRules(RadioPacketTypes_t packetType, RadioOperatingModes_t mode) {
+	// In the order the callbacks have always been run
+	static const IrqRule_t none[] = {
+		{ 0, 0, 0, 0, false }
+	};
+
+	static const IrqRule_t gfskRx[] = {
+		{ IRQ_RX_DONE | IRQ_CRC_ERROR, 0, IRQ_SLOT_RX_ERROR, IRQ_CRC_ERROR_CODE, false },
+		{ IRQ_RX_DONE | IRQ_SYNCWORD_ERROR, IRQ_CRC_ERROR, IRQ_SLOT_RX_ERROR, IRQ_SYNCWORD_ERROR_CODE, false },
+		{ IRQ_RX_DONE, IRQ_CRC_ERROR | IRQ_SYNCWORD_ERROR, IRQ_SLOT_RX_DONE, 0, false },
+		{ IRQ_SYNCWORD_VALID, 0, IRQ_SLOT_RX_SYNCWORD_DONE, 0, false },
+		{ IRQ_SYNCWORD_ERROR, 0, IRQ_SLOT_RX_ERROR, IRQ_SYNCWORD_ERROR_CODE, false },
+		{ IRQ_RX_TX_TIMEOUT, 0, IRQ_SLOT_RX_TIMEOUT, 0, true },
+		{ IRQ_TX_DONE, 0, IRQ_SLOT_TX_DONE, 0, true },
+		{ 0, 0, 0, 0, false }
+	};
+
+	static const IrqRule_t tx[] = {
+		{ IRQ_TX_DONE, 0, IRQ_SLOT_TX_DONE, 0, true },
+		{ IRQ_RX_TX_TIMEOUT, 0, IRQ_SLOT_TX_TIMEOUT, 0, true },
+		{ 0, 0, 0, 0, false }
+	};
+
+	static const IrqRule_t loraRx[] = {
+		{ IRQ_RX_DONE | IRQ_CRC_ERROR, 0, IRQ_SLOT_RX_ERROR, IRQ_CRC_ERROR_CODE, false },
+		{ IRQ_RX_DONE, IRQ_CRC_ERROR, IRQ_SLOT_RX_DONE, 0, false },
+		{ IRQ_HEADER_VALID, 0, IRQ_SLOT_RX_HEADER_DONE, 0, false },
+		{ IRQ_HEADER_ERROR, 0, IRQ_SLOT_RX_ERROR, IRQ_HEADER_ERROR_CODE, false },
+		{ IRQ_RX_TX_TIMEOUT, 0, IRQ_SLOT_RX_TIMEOUT, 0, true },
+		{ IRQ_RANGING_SLAVE_REQUEST_DISCARDED, 0, IRQ_SLOT_RX_ERROR, IRQ_RANGING_ON_LORA_ERROR_CODE, false },
+		{ 0, 0, 0, 0, false }
+	};
+
+	static const IrqRule_t loraCad[] = {
+		{ IRQ_CAD_DONE | IRQ_CAD_DETECTED, 0, IRQ_SLOT_CAD_DONE, true, false },
+		{ IRQ_CAD_DONE, IRQ_CAD_DETECTED, IRQ_SLOT_CAD_DONE, false, false },
+		{ IRQ_RX_TX_TIMEOUT, IRQ_CAD_DONE, IRQ_SLOT_RX_TIMEOUT, 0, true },
+		{ 0, 0, 0, 0, false }
+	};
+
+	// MODE_RX indicates an IRQ on the Slave side
+	static const IrqRule_t rangingRx[] = {
+		{ IRQ_RANGING_SLAVE_REQUEST_DISCARDED, 0, IRQ_SLOT_RANGING_DONE, IRQ_RANGING_SLAVE_ERROR_CODE, false },
+		{ IRQ_RANGING_SLAVE_REQUEST_VALID, 0, IRQ_SLOT_RANGING_DONE, IRQ_RANGING_SLAVE_VALID_CODE, false },
+		{ IRQ_RANGING_SLAVE_RESPONSE_DONE, 0, IRQ_SLOT_RANGING_DONE, IRQ_RANGING_SLAVE_VALID_CODE, false },
+		{ IRQ_RX_TX_TIMEOUT, 0, IRQ_SLOT_RANGING_DONE, IRQ_RANGING_SLAVE_ERROR_CODE, false },
+		{ IRQ_HEADER_VALID, 0, IRQ_SLOT_RX_HEADER_DONE, 0, false },
+		{ IRQ_HEADER_ERROR, 0, IRQ_SLOT_RX_ERROR, IRQ_HEADER_ERROR_CODE, false },
+		{ 0, 0, 0, 0, false }
+	};
+
+	// MODE_TX indicates an IRQ on the Master side
+	static const IrqRule_t rangingTx[] = {
+		{ IRQ_RANGING_MASTER_TIMEOUT, 0, IRQ_SLOT_RANGING_DONE, IRQ_RANGING_MASTER_ERROR_CODE, true },
+		{ IRQ_RANGING_MASTER_RESULT_VALID, 0, IRQ_SLOT_RANGING_DONE, IRQ_RANGING_MASTER_VALID_CODE, true },
+		{ 0, 0, 0, 0, false }
+	};
+
+	switch( packetType )
+	{
+		case PACKET_TYPE_GFSK:
+		case PACKET_TYPE_FLRC:
+		case PACKET_TYPE_BLE:
+			switch( mode )
+			{
+				case MODE_RX:
+					return gfskRx;
+				case MODE_TX:
+					return tx;
+				default:
+					// Unexpected IRQ: silently returns
+					return none;
+			}
+		case PACKET_TYPE_LORA:
+			switch( mode )
+			{
+				case MODE_RX:
+					return loraRx;
+				case MODE_TX:
+					return tx;
+				case MODE_CAD:
+					return loraCad;
+				default:
+					return none;
+			}
+		case PACKET_TYPE_RANGING:
+			switch( mode )
+			{
+				case MODE_RX:
+					return rangingRx;
+				case MODE_TX:
+					return rangingTx;
+				default:
+					return none;
+			}
+		default:
+			return none;
+	}
+}
+
+void SX128x::ProcessIrqs() {
+	ProcessIrqsExcept(0);
+}
+
+void SX128x::ProcessIrqsExcept(uint16_t leave) {
+	CallbackListener<decltype(callbacks)> listener{{}, callbacks};
+
+	if (!RxSlots) {
+		RadioPacketTypes_t packetType;
+		uint16_t irqRegs = FetchIrqs(packetType, leave);
+		const IrqRule_t *rules = IrqRules(packetType, OperatingMode);
+
+		DispatchIrqs(listener, rules, irqRegs, AdvanceStreams(irqRegs));
+
+#if SX128X_HAS_COROUTINES
+		ResumeRadioOp(irqRegs);
+#endif
+		return;
+	}
+
+	// Fill the next free slot in place, the spare one takes the IRQs while the ring is full
+	size_t head = RxHead.load(std::memory_order_relaxed);
+	bool full = head - RxTail.load(std::memory_order_acquire) > RxSlotMask;
+	RxCompletion_t &rx = RxSlots[full ? RxSlotMask + 1 : head & RxSlotMask].Rx;
+
+	ServiceIrqs(rx, RxPrefetch, leave);
+
+	uint16_t dispatched = rx.IrqRegs;
+
+	if (( rx.IrqRegs & IRQ_RX_DONE ) == IRQ_RX_DONE &&
+	    !( rx.IrqRegs & ( IRQ_CRC_ERROR | IRQ_SYNCWORD_ERROR | IRQ_HEADER_ERROR ) ))
+	{
+		// A dropped packet gets no rxDone, the consumer would look for it in the ring
+		if (full) {
+			RxDropped.fetch_add(1, std::memory_order_relaxed);
+			dispatched &= ~IRQ_RX_DONE;
+		} else {
+			RxHead.store(head + 1, std::memory_order_release);
+		}
+	}
+
+	// The packet is in the ring before rxDone can re-arm Rx
+	const IrqRule_t *rules = IrqRules(PacketType, OperatingMode);
+
+	DispatchIrqs(listener, rules, dispatched, AdvanceStreams(rx.IrqRegs));
+
+#if SX128X_HAS_COROUTINES
+	ResumeRadioOp(rx.IrqRegs);
+#endif
+}
+
+void SX128x::EnableRxRing(size_t slots, uint8_t prefetch) {
+	if (slots < 2 || ( slots & ( slots - 1 ) ))
+		throw std::invalid_argument("ring size must be a power of 2");
+
+	// One spare slot for IRQs serviced while the ring is full
+	RxSlots.reset(new RxSlot_t[slots + 1]);
+	RxSlotMask = slots - 1;
+	RxPrefetch = prefetch;
+	RxHead.store(0, std::memory_order_relaxed);
+	RxTail.store(0, std::memory_order_relaxed);
+	RxDropped.store(0, std::memory_order_relaxed);
+}
+
+const SX128x::RxCompletion_t *SX128x::PeekRx() {
+	size_t tail = RxTail.load(std::memory_order_relaxed);
+
+	if (!RxSlots || tail == RxHead.load(std::memory_order_acquire))
+		return nullptr;
+
+	return &RxSlots[tail & RxSlotMask].Rx;
+}
+
+void SX128x::PopRx() {
+	size_t tail = RxTail.load(std::memory_order_relaxed);
+
+	// Past the head the ring would read as full from then on
+	if (tail == RxHead.load(std::memory_order_acquire))
+		return;
+
+	RxTail.store(tail + 1, std::memory_order_release);
+}
+
+uint32_t SX128x::GetRxDropped() const {
+	return RxDropped.load(std::memory_order_relaxed);
+}
+
+SX128x::IrqDispatchBenchmark_t SX128x::BenchmarkIrqDispatch(uint32_t iterations) {
+	IrqDispatchBenchmark_t ret = {0, 0};
+
+	// Reception IRQs of each modem, none of them touches the RF switch
+	static const struct {
+		RadioPacketTypes_t PacketType;
+		RadioOperatingModes_t Mode;
+		uint16_t IrqRegs;
+	} cases[] = {
+		{ PACKET_TYPE_GFSK, MODE_RX, IRQ_RX_DONE | IRQ_SYNCWORD_VALID },
+		{ PACKET_TYPE_LORA, MODE_RX, IRQ_RX_DONE | IRQ_HEADER_VALID },
+		{ PACKET_TYPE_LORA, MODE_RX, IRQ_RX_DONE | IRQ_HEADER_VALID | IRQ_CRC_ERROR },
+		{ PACKET_TYPE_LORA, MODE_CAD, IRQ_CAD_DONE | IRQ_CAD_DETECTED },
+	};
+	const size_t count = sizeof(cases) / sizeof(cases[0]);
+
+	if (!iterations)
+		return ret;
+
+	struct CountingListener : IrqListener {
+		volatile uint32_t Calls = 0;
+
+		void OnRxDone() { Calls = Calls + 1; }
+		void OnRxSyncWordDone() { Calls = Calls + 1; }
+		void OnRxHeaderDone() { Calls = Calls + 1; }
+		void OnRxError(IrqErrorCode_t) { Calls = Calls + 1; }
+		void OnCadDone(bool) { Calls = Calls + 1; }
+	} counting;
+
+	volatile uint32_t calls = 0;
+	RadioCallbacks_t cbs = {};
+	cbs.rxDone = [&calls]() { calls = calls + 1; };
+	cbs.rxSyncWordDone = [&calls]() { calls = calls + 1; };
+	cbs.rxHeaderDone = [&calls]() { calls = calls + 1; };
+	cbs.rxError = [&calls](IrqErrorCode_t) { calls = calls + 1; };
+	cbs.cadDone = [&calls](bool) { calls = calls + 1; };
+	CallbackListener<RadioCallbacks_t> forwarding{{}, cbs};
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i=0; i<iterations; i++) {
+		auto &c = cases[i % count];
+		DispatchIrqs(counting, IrqRules(c.PacketType, c.Mode), c.IrqRegs);
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	ret.TableNs = elapsed.count() / iterations;
+
+	start = std::chrono::steady_clock::now();
+	for (uint32_t i=0; i<iterations; i++) {
+		auto &c = cases[i % count];
+		DispatchIrqs(forwarding, IrqRules(c.PacketType, c.Mode), c.IrqRegs);
+	}
+	elapsed = std::chrono::steady_clock::now() - start;
+	ret.CallbacksNs = elapsed.count() / iterations;
+
+	return ret;
+}
+
+#if SX128X_HAS_COROUTINES
+SX128x::RadioOp SX128x::Transmit(std::span<const uint8_t> payload, TickTime_t timeout) {
+	if (payload.size() > 255)
+		throw std::invalid_argument("payload longer than 255 bytes");
 
-	RadioPacketTypes_t packetType = PACKET_TYPE_NONE;
+	return RadioOp(*this, RadioOp::OP_TX, std::span<uint8_t>(const_cast<uint8_t *>(payload.data()), payload.size()), timeout);
+}
 
-//	if (this->PollingMode == true )
-//	{
-//		if (this->IrqState == true )
-//		{
-////            __disable_irq();
-//			this->IrqState = false;
-////            __enable_irq();
-//		}
-//		else
-//		{
-//			return;
-//		}
-//	}
+SX128x::RadioOp SX128x::Receive(std::span<uint8_t> buffer, TickTime_t timeout) {
+	return RadioOp(*this, RadioOp::OP_RX, buffer, timeout);
+}
 
-	packetType = GetPacketType( true );
-	uint16_t irqRegs = GetIrqStatus();
-	ClearIrqStatus( IRQ_RADIO_ALL );
+SX128x::RadioOp SX128x::Cad() {
+	return RadioOp(*this, RadioOp::OP_CAD, {}, RX_TX_SINGLE);
+}
 
-	lg.unlock();
-
-	auto& txDone = callbacks.txDone;
-	auto& rxDone = callbacks.rxDone;
-	auto& rxSyncWordDone = callbacks.rxSyncWordDone;
-	auto& rxHeaderDone = callbacks.rxHeaderDone;
-	auto& txTimeout = callbacks.txTimeout;
-	auto& rxTimeout = callbacks.rxTimeout;
-	auto& rxError = callbacks.rxError;
-	auto& rangingDone = callbacks.rangingDone;
-	auto& cadDone = callbacks.cadDone;
-
-//#if (SX1280_DEBUG == 1 )
-//	DigitalOut TEST_PIN_1( D14 );
-//	DigitalOut TEST_PIN_2( D15 );
-//	for( int i = 0x8000; i != 0; i >>= 1 )
-//	{
-//	TEST_PIN_2 = 0;
-//	TEST_PIN_1 = ( ( irqRegs & i ) != 0 ) ? 1 : 0;
-//	TEST_PIN_2 = 1;
-//	}
-//	TEST_PIN_1 = 0;
-//	TEST_PIN_2 = 0;
-//#endif
+bool SX128x::RadioOp::await_suspend(std::coroutine_handle<> handle) {
+	// Once started, this may be resumed and destroyed by another thread
+	SX128x &radio = Radio;
+
+	Handle = handle;
+	Next = nullptr;
 
-	switch( packetType )
 	{
-		case PACKET_TYPE_GFSK:
-		case PACKET_TYPE_FLRC:
-		case PACKET_TYPE_BLE:
-			switch( OperatingMode )
-			{
-				case MODE_RX:
-					if (( irqRegs & IRQ_RX_DONE ) == IRQ_RX_DONE )
-					{
-						if (( irqRegs & IRQ_CRC_ERROR ) == IRQ_CRC_ERROR )
-						{
-							if (rxError)
-								rxError(IRQ_CRC_ERROR_CODE);
-						}
-						else if (( irqRegs & IRQ_SYNCWORD_ERROR ) == IRQ_SYNCWORD_ERROR )
-						{
-							if (rxError)
-								rxError(IRQ_SYNCWORD_ERROR_CODE);
-						}
-						else
-						{
-							if (rxDone)
-								rxDone();
-						}
-					}
-					if (( irqRegs & IRQ_SYNCWORD_VALID ) == IRQ_SYNCWORD_VALID )
-					{
-						if (rxSyncWordDone)
-							rxSyncWordDone();
-					}
-					if (( irqRegs & IRQ_SYNCWORD_ERROR ) == IRQ_SYNCWORD_ERROR )
-					{
-						if (rxError)
-							rxError( IRQ_SYNCWORD_ERROR_CODE);
-
-					}
-					if (( irqRegs & IRQ_RX_TX_TIMEOUT ) == IRQ_RX_TX_TIMEOUT )
-					{
-						HalPostRx();
-						if (rxTimeout)
-							rxTimeout();
-					}
-					if (( irqRegs & IRQ_TX_DONE ) == IRQ_TX_DONE )
-					{
-						HalPostTx();
-						if (txDone)
-							txDone();
-					}
-					break;
-				case MODE_TX:
-					if (( irqRegs & IRQ_TX_DONE ) == IRQ_TX_DONE )
-					{
-						HalPostTx();
-						if (txDone)
-							txDone();
-					}
-					if (( irqRegs & IRQ_RX_TX_TIMEOUT ) == IRQ_RX_TX_TIMEOUT )
-					{
-						HalPostTx();
-						if (txTimeout)
-							txTimeout();
-
-					}
-					break;
-				default:
-					// Unexpected IRQ: silently returns
-					break;
-			}
-			break;
-		case PACKET_TYPE_LORA:
-			switch( OperatingMode )
-			{
-				case MODE_RX:
-					if (( irqRegs & IRQ_RX_DONE ) == IRQ_RX_DONE )
-					{
-						if (( irqRegs & IRQ_CRC_ERROR ) == IRQ_CRC_ERROR )
-						{
-							if (rxError)
-								rxError(IRQ_CRC_ERROR_CODE);
-						}
-						else
-						{
-							if (rxDone)
-								rxDone();
-						}
-					}
-					if (( irqRegs & IRQ_HEADER_VALID ) == IRQ_HEADER_VALID )
-					{
-						if (rxHeaderDone)
-							rxHeaderDone();
-					}
-					if (( irqRegs & IRQ_HEADER_ERROR ) == IRQ_HEADER_ERROR )
-					{
-						if (rxError)
-							rxError( IRQ_HEADER_ERROR_CODE);
-					}
-					if (( irqRegs & IRQ_RX_TX_TIMEOUT ) == IRQ_RX_TX_TIMEOUT )
-					{
-						HalPostRx();
-						if (rxTimeout)
-							rxTimeout();
-					}
-					if (( irqRegs & IRQ_RANGING_SLAVE_REQUEST_DISCARDED ) == IRQ_RANGING_SLAVE_REQUEST_DISCARDED )
-					{
-						if (rxError)
-							rxError( IRQ_RANGING_ON_LORA_ERROR_CODE);
-					}
-					break;
-				case MODE_TX:
-					if (( irqRegs & IRQ_TX_DONE ) == IRQ_TX_DONE )
-					{
-						HalPostTx();
-						if (txDone)
-							txDone();
-					}
-					if (( irqRegs & IRQ_RX_TX_TIMEOUT ) == IRQ_RX_TX_TIMEOUT )
-					{
-						HalPostTx();
-						if (txTimeout)
-							txTimeout();
-					}
-					break;
-				case MODE_CAD:
-					if (( irqRegs & IRQ_CAD_DONE ) == IRQ_CAD_DONE )
-					{
-						if (( irqRegs & IRQ_CAD_DETECTED ) == IRQ_CAD_DETECTED )
-						{
-							if (cadDone)
-								cadDone( true );
-						}
-						else
-						{
-							if (cadDone)
-								cadDone( false );
-						}
-					}
-					else if (( irqRegs & IRQ_RX_TX_TIMEOUT ) == IRQ_RX_TX_TIMEOUT )
-					{
-						HalPostRx();
-						if (rxTimeout)
-							rxTimeout();
-					}
-					break;
-				default:
-					// Unexpected IRQ: silently returns
-					break;
-			}
-			break;
-		case PACKET_TYPE_RANGING:
-			switch( OperatingMode )
-			{
-				// MODE_RX indicates an IRQ on the Slave side
-				case MODE_RX:
-					if (( irqRegs & IRQ_RANGING_SLAVE_REQUEST_DISCARDED ) == IRQ_RANGING_SLAVE_REQUEST_DISCARDED )
-					{
-						if (rangingDone)
-							rangingDone(IRQ_RANGING_SLAVE_ERROR_CODE);
-					}
-					if (( irqRegs & IRQ_RANGING_SLAVE_REQUEST_VALID ) == IRQ_RANGING_SLAVE_REQUEST_VALID )
-					{
-						if (rangingDone)
-							rangingDone(IRQ_RANGING_SLAVE_VALID_CODE);
-					}
-					if (( irqRegs & IRQ_RANGING_SLAVE_RESPONSE_DONE ) == IRQ_RANGING_SLAVE_RESPONSE_DONE )
-					{
-						if (rangingDone)
-							rangingDone(IRQ_RANGING_SLAVE_VALID_CODE);
-					}
-					if (( irqRegs & IRQ_RX_TX_TIMEOUT ) == IRQ_RX_TX_TIMEOUT )
-					{
-						if (rangingDone)
-							rangingDone(IRQ_RANGING_SLAVE_ERROR_CODE);
-					}
-					if (( irqRegs & IRQ_HEADER_VALID ) == IRQ_HEADER_VALID )
-					{
-						if (rxHeaderDone)
-							rxHeaderDone();
-					}
-					if (( irqRegs & IRQ_HEADER_ERROR ) == IRQ_HEADER_ERROR )
-					{
-						if (rxError)
-							rxError(IRQ_HEADER_ERROR_CODE);
-					}
+		std::lock_guard<std::mutex> lg(radio.OpLock);
+
+		if (radio.OpTail)
+			radio.OpTail->Next = this;
+		else
+			radio.OpHead = this;
+		radio.OpTail = this;
+
+		if (radio.OpHead != this)
+			return true;
+	}
+
+	return !radio.StartRadioOps(this, this);
+}
+
+SX128x::RadioOp *SX128x::PopRadioOp() {
+	OpHead = OpHead->Next;
+	if (!OpHead)
+		OpTail = nullptr;
+
+	return OpHead;
+}
+
+bool SX128x::StartRadioOps(RadioOp *op, RadioOp *self) {
+	bool selfFailed = false;
+
+	while (op) {
+		try {
+			switch (op->Kind) {
+				case RadioOp::OP_TX:
+					SendPayload(op->Buffer.data(), op->Buffer.size(), op->Timeout);
 					break;
-					// MODE_TX indicates an IRQ on the Master side
-				case MODE_TX:
-					if (( irqRegs & IRQ_RANGING_MASTER_TIMEOUT ) == IRQ_RANGING_MASTER_TIMEOUT )
-					{
-						HalPostTx();
-						if (rangingDone)
-							rangingDone(IRQ_RANGING_MASTER_ERROR_CODE);
-					}
-					if (( irqRegs & IRQ_RANGING_MASTER_RESULT_VALID ) == IRQ_RANGING_MASTER_RESULT_VALID )
-					{
-						HalPostTx();
-						if (rangingDone)
-							rangingDone(IRQ_RANGING_MASTER_VALID_CODE);
-					}
+				case RadioOp::OP_RX:
+					SetRx(op->Timeout);
 					break;
-				default:
-					// Unexpected IRQ: silently returns
+				case RadioOp::OP_CAD:
+					SetCad();
 					break;
 			}
-			break;
-		default:
-			// Unexpected IRQ: silently returns
-			break;
+			return selfFailed;
+		} catch (...) {
+			op->Failure = std::current_exception();
+		}
+
+		RadioOp *failed = op;
+
+		{
+			std::lock_guard<std::mutex> lg(OpLock);
+			op = PopRadioOp();
+		}
+
+		if (failed == self)
+			selfFailed = true;
+		else
+			failed->Handle.resume();
+	}
+
+	return selfFailed;
+}
+
+void SX128x::ResumeRadioOp(uint16_t irqRegs) {
+	RadioOp *op, *next;
+	bool readPayload = false;
+
+	{
+		std::lock_guard<std::mutex> lg(OpLock);
+
+		if (!(op = OpHead))
+			return;
+
+		RadioOpResult_t &result = op->Result;
+
+		switch (op->Kind) {
+			case RadioOp::OP_TX:
+				if (irqRegs & IRQ_TX_DONE)
+					result.Status = RADIO_OP_DONE;
+				else if (irqRegs & IRQ_RX_TX_TIMEOUT)
+					result.Status = RADIO_OP_TIMEOUT;
+				else
+					return;
+				break;
+			case RadioOp::OP_RX:
+				if (irqRegs & IRQ_CRC_ERROR) {
+					result.Status = RADIO_OP_ERROR;
+					result.Error = IRQ_CRC_ERROR_CODE;
+				} else if (irqRegs & IRQ_SYNCWORD_ERROR) {
+					result.Status = RADIO_OP_ERROR;
+					result.Error = IRQ_SYNCWORD_ERROR_CODE;
+				} else if (irqRegs & IRQ_HEADER_ERROR) {
+					result.Status = RADIO_OP_ERROR;
+					result.Error = IRQ_HEADER_ERROR_CODE;
+				} else if (irqRegs & IRQ_RX_DONE) {
+					result.Status = RADIO_OP_DONE;
+					readPayload = true;
+				} else if (irqRegs & IRQ_RX_TX_TIMEOUT) {
+					result.Status = RADIO_OP_TIMEOUT;
+				} else {
+					return;
+				}
+				break;
+			case RadioOp::OP_CAD:
+				if (irqRegs & IRQ_CAD_DONE) {
+					result.Status = RADIO_OP_DONE;
+					result.CadDetected = (irqRegs & IRQ_CAD_DETECTED) != 0;
+				} else if (irqRegs & IRQ_RX_TX_TIMEOUT) {
+					result.Status = RADIO_OP_TIMEOUT;
+				} else {
+					return;
+				}
+				break;
+		}
+
+		next = PopRadioOp();
 	}
+
+	// Before the next operation can reuse the buffer
+	if (readPayload) {
+		try {
+			uint8_t maxSize = op->Buffer.size() > 255 ? 255 : op->Buffer.size();
+			if (GetPayload(op->Buffer.data(), &op->Result.Size, maxSize))
+				op->Result.Status = RADIO_OP_OVERFLOW;
+		} catch (...) {
+			op->Failure = std::current_exception();
+		}
+	}
+
+	StartRadioOps(next, nullptr);
+
+	op->Handle.resume();
 }
+#endif
 
 uint16_t SX128x::GetTimeOnAir(const SX128x::ModulationParams_t &modparams, const SX128x::PacketParams_t &pktparams) {
-	uint16_t result = 2000;
+	return ceil( TimeOnAirMs( modparams, pktparams ) );
+}
+
+double SX128x::TimeOnAirMs(const SX128x::ModulationParams_t &modparams, const SX128x::PacketParams_t &pktparams) {
+	double result = 2000;
 	double tPayload = 0.0;
 
 	if( modparams.PacketType == PACKET_TYPE_LORA )
@@ -1288,7 +2092,7 @@ uint16_t SX128x::GetTimeOnAir(const SX128x::ModulationParams_t &modparams, const
 #ifdef PRINT_DEBUG
 		printf( "ToA LoRa: %f \n\r", tPayload );
 #endif
-		result = ceil( tPayload );
+		result = tPayload;
 	}
 	else if(modparams.PacketType == PACKET_TYPE_FLRC )
 	{
@@ -1352,9 +2156,11 @@ uint16_t SX128x::GetTimeOnAir(const SX128x::ModulationParams_t &modparams, const
 				break;
 		}
 
+#ifdef PRINT_DEBUG
 		printf( "ToA FLRC: %f \n\r", tPayload );
+#endif
 
-		result = ceil( tPayload );
+		result = tPayload;
 	}
 	else if( modparams.PacketType == PACKET_TYPE_GFSK )
 	{
@@ -1411,7 +2217,7 @@ uint16_t SX128x::GetTimeOnAir(const SX128x::ModulationParams_t &modparams, const
 #ifdef PRINT_DEBUG
 		printf( "ToA GFSK: %f \n\r", tPayload );
 #endif
-		result = ceil( tPayload );
+		result = tPayload;
 	}
 
 	return result;
@@ -1421,40 +2227,317 @@ uint16_t SX128x::GetTimeOnAir() {
 	return GetTimeOnAir(CurrentModParams, CurrentPacketParams);
 }
 
+SX128x::PacketParams_t SX128x::WithPayloadLength(uint8_t payloadLength) {
+	PacketParams_t pktparams = CurrentPacketParams;
+
+	// The union members overlap, only the active one may be written
+	switch( pktparams.PacketType )
+	{
+		case PACKET_TYPE_GFSK:
+			pktparams.Params.Gfsk.PayloadLength = payloadLength;
+			break;
+		case PACKET_TYPE_LORA:
+		case PACKET_TYPE_RANGING:
+			pktparams.Params.LoRa.PayloadLength = payloadLength;
+			break;
+		case PACKET_TYPE_FLRC:
+			pktparams.Params.Flrc.PayloadLength = payloadLength;
+			break;
+		default:
+			break;
+	}
+
+	return pktparams;
+}
+
+uint16_t SX128x::GetTimeOnAir(uint8_t payloadLength) {
+	return GetTimeOnAir(CurrentModParams, WithPayloadLength(payloadLength));
+}
+
+uint32_t SX128x::GetTimeOnAirUs(uint8_t payloadLength) {
+	return ceil( TimeOnAirMs( CurrentModParams, WithPayloadLength(payloadLength) ) * 1000 );
+}
+
+
+void SX128x::HalSetRfPath(RfPath_t path) {
+	switch (path) {
+		case RF_PATH_TX:
+			HalPostRx();
+			HalPreTx();
+			break;
+		case RF_PATH_RX:
+			HalPostTx();
+			HalPreRx();
+			break;
+		case RF_PATH_OFF:
+			HalPostTx();
+			HalPostRx();
+			break;
+	}
+}
 
 void SX128x::HalSpiRead(uint8_t *buffer_in, uint16_t size) {
-   //cfs error: ISO C++ forbids variable length array ‘useless’
-	//cfs todo: Create a static size solution
-   //cfs uint8_t useless[size];
-	//cfs memset(useless, 0, size);
-   uint8_t useless[1024];     //cfs
-	memset(useless, 0, 1024);  //cfs
-	HalSpiTransfer(buffer_in, useless, size);
+	memset(buffer_in, 0, size);
+	HalSpiTransfer(buffer_in, buffer_in, size);
 }
 
 void SX128x::HalSpiWrite(const uint8_t *buffer_out, uint16_t size) {
-   //cfs error: ISO C++ forbids variable length array ‘useless’
-	//uint8_t useless[size];
-   //cfs todo: Create a static size solution
-   uint8_t useless[1024];     //cfs
-	HalSpiTransfer(useless, buffer_out, size);
+	auto *discard = (uint8_t *)alloca(size);
+	HalSpiTransfer(discard, buffer_out, size);
+}
+
+void SX128x::HalSpiTransferV(const SpiIoVec_t *iov, size_t count) {
+	size_t total_transfer_size = 0;
+
+	for (size_t i=0; i<count; i++)
+		total_transfer_size += iov[i].size;
+
+	if (!total_transfer_size)
+		return;
+
+	auto *buf_out = (uint8_t *)alloca(total_transfer_size);
+	auto *buf_in = (uint8_t *)alloca(total_transfer_size);
+
+	size_t pos = 0;
+	for (size_t i=0; i<count; i++) {
+		if (iov[i].buffer_out)
+			memcpy(buf_out+pos, iov[i].buffer_out, iov[i].size);
+		else
+			memset(buf_out+pos, 0, iov[i].size);
+		pos += iov[i].size;
+	}
+
+	HalSpiTransfer(buf_in, buf_out, total_transfer_size);
+
+	pos = 0;
+	for (size_t i=0; i<count; i++) {
+		if (iov[i].buffer_in)
+			memcpy(iov[i].buffer_in, buf_in+pos, iov[i].size);
+		pos += iov[i].size;
+	}
+}
+
+void SX128x::HalSpiTransferBatch(const SpiSegment_t *segments, size_t count) {
+	for (size_t i=0; i<count; i++) {
+		if (i)
+			WaitOnBusy();
+
+		if (segments[i].buffer_in)
+			HalSpiTransfer(segments[i].buffer_in, segments[i].buffer_out, segments[i].size);
+		else
+			HalSpiWrite(segments[i].buffer_out, segments[i].size);
+	}
 }
 
 void SX128x::WaitOnBusy() {
 	while (HalGpioRead(GPIO_PIN_BUSY)) {
-		std::this_thread::sleep_for(std::chrono::microseconds(10));
+		if (!HalGpioWaitFallingEdge(GPIO_PIN_BUSY, BUSY_EDGE_WAIT_US))
+			std::this_thread::sleep_for(std::chrono::microseconds(10));
+	}
+}
+
+void SX128x::WaitOnBusy(RadioCommands_t opcode) {
+	auto start = std::chrono::steady_clock::now();
+	uint32_t expected_us = BusyStats[opcode].Count ? BusyStats[opcode].ExpectedNs / 1000 : UINT32_MAX;
+
+	// Each tier in turn gets twice the expected time before moving to a cheaper one,
+	// the thresholds are cumulative
+	uint32_t spin_us = expected_us <= BUSY_SPIN_MAX_US ? 2 * expected_us + 1 : 0;
+	uint32_t yield_us = expected_us <= BUSY_YIELD_MAX_US ? spin_us + 2 * expected_us + 1 : 0;
+
+	while (HalGpioRead(GPIO_PIN_BUSY)) {
+		auto elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+		if (elapsed_us < spin_us)
+			continue;
+
+		if (elapsed_us < yield_us) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		if (!HalGpioWaitFallingEdge(GPIO_PIN_BUSY, BUSY_EDGE_WAIT_US))
+			std::this_thread::sleep_for(std::chrono::microseconds(10));
+	}
+
+	UpdateBusyStat(opcode, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+
+	BusyIdle.Low = true;
+
+	switch (opcode) {
+		// The radio leaves these modes on its own, which may raise BUSY
+		case RADIO_SET_TX:
+		case RADIO_SET_RX:
+		case RADIO_SET_RXDUTYCYCLE:
+		case RADIO_SET_CAD:
+		case RADIO_SET_TXCONTINUOUSWAVE:
+		case RADIO_SET_TXCONTINUOUSPREAMBLE:
+			BusyIdle.Autonomous = true;
+			break;
+		case RADIO_SET_STANDBY:
+		case RADIO_SET_FS:
+			BusyIdle.Autonomous = false;
+			break;
+		default:
+			break;
+	}
+}
+
+void SX128x::WaitOnBusyUnlessIdle() {
+	bool idle = BusyIdle.Low && !BusyIdle.Autonomous;
+
+	// The command about to be sent raises BUSY again
+	BusyIdle.Low = false;
+
+	if (!idle)
+		WaitOnBusy();
+}
+
+void SX128x::UpdateBusyStat(RadioCommands_t opcode, uint32_t busyNs) {
+	BusyStat_t &stat = BusyStats[opcode];
+
+	if (stat.Count == 0) {
+		stat.ExpectedNs = busyNs;
+	} else {
+		// EWMA with alpha = 1/8
+		stat.ExpectedNs = static_cast<uint32_t>(static_cast<int64_t>(stat.ExpectedNs) + (static_cast<int64_t>(busyNs) - stat.ExpectedNs) / 8);
 	}
+
+	if (busyNs > stat.MaxNs)
+		stat.MaxNs = busyNs;
+
+	if (stat.Count < UINT32_MAX)
+		stat.Count++;
+}
+
+SX128x::BusyStat_t SX128x::GetBusyStat(RadioCommands_t opcode) {
+	std::lock_guard<std::mutex> lg(IOLock);
+
+	return BusyStats[opcode];
+}
+
+void SX128x::ResetBusyStats(void) {
+	std::lock_guard<std::mutex> lg(IOLock);
+
+	memset(BusyStats, 0, sizeof(BusyStats));
 }
 
 void SX128x::WaitOnBusyLong() {
 	while (HalGpioRead(GPIO_PIN_BUSY)) {
-		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		if (!HalGpioWaitFallingEdge(GPIO_PIN_BUSY, BUSY_EDGE_WAIT_US))
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+bool SX128x::InTransaction(void) const {
+	return BatchOwner.load(std::memory_order_relaxed) == std::this_thread::get_id();
+}
+
+bool SX128x::IsBatchable(RadioCommands_t opcode) {
+	switch (opcode) {
+		case RADIO_SET_SLEEP:
+		case RADIO_SET_STANDBY:
+		case RADIO_SET_FS:
+		case RADIO_SET_TX:
+		case RADIO_SET_RX:
+		case RADIO_SET_RXDUTYCYCLE:
+		case RADIO_SET_CAD:
+		case RADIO_SET_TXCONTINUOUSWAVE:
+		case RADIO_SET_TXCONTINUOUSPREAMBLE:
+		case RADIO_CALIBRATE:
+		case RADIO_SET_SAVECONTEXT:
+			return false;
+		default:
+			return true;
+	}
+}
+
+bool SX128x::QueueTransfer(const uint8_t *header, uint16_t headerSize, const uint8_t *payload, uint16_t size) {
+	size_t total_transfer_size = headerSize+size;
+
+	if (total_transfer_size > SPI_BATCH_MAX_BYTES)
+		return false;
+
+	if (BatchSegmentCount == SPI_BATCH_MAX_SEGMENTS || BatchBytesUsed+total_transfer_size > SPI_BATCH_MAX_BYTES)
+		FlushTransaction();
+
+	uint8_t *buf_out = BatchBytes+BatchBytesUsed;
+
+	memcpy(buf_out, header, headerSize);
+	if (size)
+		memcpy(buf_out+headerSize, payload, size);
+
+	BatchSegments[BatchSegmentCount++] = {nullptr, buf_out, static_cast<uint16_t>(total_transfer_size), BatchDelay(header[0])};
+	BatchBytesUsed += total_transfer_size;
+
+	return true;
+}
+
+void SX128x::FlushTransaction(void) {
+	size_t count = BatchSegmentCount;
+
+	if (!count)
+		return;
+
+	BatchSegmentCount = 0;
+	BatchBytesUsed = 0;
+
+	// The trailing BUSY period is covered by the poll below
+	BatchSegments[count-1].delay_usecs = 0;
+
+	std::lock_guard<std::mutex> lg(IOLock);
+
+	if (SX1280_DEBUG) {
+		printf("SX1280: FlushTransaction: %zu commands\n", count);
 	}
+
+	WaitOnBusyUnlessIdle();
+
+	HalSpiTransferBatch(BatchSegments, count);
+
+	WaitOnBusy(static_cast<RadioCommands_t>(BatchSegments[count-1].buffer_out[0]));
+}
+
+void SX128x::BeginTransaction(void) {
+	BatchLock.lock();
+	BatchOwner.store(std::this_thread::get_id(), std::memory_order_relaxed);
+}
+
+void SX128x::CommitTransaction(void) {
+	std::lock_guard<std::mutex> lg(BatchLock, std::adopt_lock);
+
+	BatchOwner.store(std::thread::id(), std::memory_order_relaxed);
+	FlushTransaction();
+}
+
+void SX128x::AbortTransaction(void) {
+	std::lock_guard<std::mutex> lg(BatchLock, std::adopt_lock);
+
+	BatchOwner.store(std::thread::id(), std::memory_order_relaxed);
+	BatchSegmentCount = 0;
+	BatchBytesUsed = 0;
+}
+
+void SX128x::SetTransactionBusyDelay(uint16_t usecs) {
+	BatchBusyDelay = usecs;
+}
+
+uint16_t SX128x::BatchDelay(uint8_t opcode) const {
+	const BusyStat_t &stat = BusyStats[opcode];
+
+	// Twice the expected time, like the tiers of WaitOnBusy( opcode )
+	if (!stat.Count)
+		return BatchBusyDelay;
+
+	return std::min<uint32_t>(2 * ( stat.ExpectedNs / 1000 ) + 1, UINT16_MAX);
 }
 
 void SX128x::Reset(void) {
 	std::lock_guard<std::mutex> lg(IOLock);
 
+	BusyIdle.Low = false;
+	BusyIdle.Autonomous = false;
+
 	HalGpioWrite(GPIO_PIN_RESET, 0);
 	std::this_thread::sleep_for(std::chrono::milliseconds(10));
 	HalGpioWrite(GPIO_PIN_RESET, 1);
@@ -1476,16 +2559,29 @@ void SX128x::Wakeup(void) {
 	// Wait for chip to be ready.
 	WaitOnBusyLong();
 
+	// Standby after wakeup
+	BusyIdle.Low = true;
+	BusyIdle.Autonomous = false;
+
 	if (SX1280_DEBUG) {
 		printf("SX1280: Wakeup done\n");
 	}
 }
 
 void SX128x::WriteCommand(SX128x::RadioCommands_t opcode, uint8_t *buffer, uint16_t size) {
-	auto *merged_buf = (uint8_t *)alloca(size+1);
+	uint8_t header = opcode;
+
+	if (InTransaction()) {
+		if (IsBatchable(opcode) && QueueTransfer(&header, 1, buffer, size))
+			return;
+
+		FlushTransaction();
+	}
 
-	merged_buf[0] = opcode;
-	memcpy(merged_buf+1, buffer, size);
+	SpiIoVec_t iov[2] = {
+		{nullptr, &header, 1},
+		{nullptr, buffer, size}
+	};
 
 	std::lock_guard<std::mutex> lg(IOLock);
 
@@ -1493,16 +2589,16 @@ void SX128x::WriteCommand(SX128x::RadioCommands_t opcode, uint8_t *buffer, uint1
 		printf("SX1280: WriteCommand: 0x%02x %u\n", opcode, size);
 	}
 
-	WaitOnBusy();
+	WaitOnBusyUnlessIdle();
 
-	HalSpiWrite(merged_buf, size+1);
+	HalSpiTransferV(iov, size ? 2 : 1);
 
 	if (SX1280_DEBUG) {
 		printf("SX1280: WriteCommand: send done\n");
 	}
 
 	if (opcode != RADIO_SET_SLEEP) {
-		WaitOnBusy();
+		WaitOnBusy(opcode);
 		if (SX1280_DEBUG) {
 			printf("SX1280: WriteCommand: wait done\n");
 		}
@@ -1510,9 +2606,12 @@ void SX128x::WriteCommand(SX128x::RadioCommands_t opcode, uint8_t *buffer, uint1
 }
 
 void SX128x::ReadCommand(SX128x::RadioCommands_t opcode, uint8_t *buffer, uint16_t size) {
+	if (InTransaction())
+		FlushTransaction();
+
 	std::lock_guard<std::mutex> lg(IOLock);
 
-	WaitOnBusy();
+	WaitOnBusyUnlessIdle();
 
 	if (opcode == RADIO_GET_STATUS) {
 		uint8_t buf_out[3] = {static_cast<uint8_t>(opcode), 0, 0};
@@ -1521,45 +2620,49 @@ void SX128x::ReadCommand(SX128x::RadioCommands_t opcode, uint8_t *buffer, uint16
 		HalSpiTransfer(buf_in, buf_out, 3);
 		buffer[0] = buf_in[0];
 	} else {
-		auto total_transfer_size = 2+size;
+		// Opcode and NOP, then the response
+		uint8_t header[2] = {static_cast<uint8_t>(opcode), 0};
+		SpiIoVec_t iov[2] = {
+			{nullptr, header, 2},
+			{buffer, nullptr, size}
+		};
+
+		HalSpiTransferV(iov, 2);
+	}
+
+	WaitOnBusy(opcode);
+}
 
-		auto *buf_out = (uint8_t *)alloca(total_transfer_size);
-		auto *buf_in = (uint8_t *)alloca(total_transfer_size);
+void SX128x::WriteRegister(uint16_t address, uint8_t *buffer, uint16_t size) {
+	uint8_t header[3] = {RADIO_WRITE_REGISTER, static_cast<uint8_t>((address & 0xFF00) >> 8), static_cast<uint8_t>(address & 0x00FF)};
 
-		memset(buf_out, 0, total_transfer_size);
-		buf_out[0] = opcode;
+	if (InTransaction()) {
+		if (QueueTransfer(header, 3, buffer, size))
+			return;
 
-		HalSpiTransfer(buf_in, buf_out, total_transfer_size);
-		memcpy(buffer, buf_in+2, size);
+		FlushTransaction();
 	}
 
-	WaitOnBusy();
-}
+	SpiIoVec_t iov[2] = {
+		{nullptr, header, 3},
+		{nullptr, buffer, size}
+	};
 
-void SX128x::WriteRegister(uint16_t address, uint8_t *buffer, uint16_t size) {
 	std::lock_guard<std::mutex> lg(IOLock);
 
 	if (SX1280_DEBUG) {
 		printf("SX1280: WriteRegister: 0x%04x %u\n", address, size);
 	}
 
-	WaitOnBusy();
+	WaitOnBusyUnlessIdle();
 
-	auto total_transfer_size = 3+size;
-	auto *buf_out = (uint8_t *)alloca(total_transfer_size);
-
-	buf_out[0] = RADIO_WRITE_REGISTER;
-	buf_out[1] = ((address & 0xFF00) >> 8);
-	buf_out[2] = (address & 0x00FF);
-	memcpy(buf_out+3, buffer, size);
-
-	HalSpiWrite(buf_out, total_transfer_size);
+	HalSpiTransferV(iov, 2);
 
 	if (SX1280_DEBUG) {
 		printf("SX1280: WriteRegister: send done\n");
 	}
 
-	WaitOnBusy();
+	WaitOnBusy(RADIO_WRITE_REGISTER);
 
 	if (SX1280_DEBUG) {
 		printf("SX1280: WriteRegister: Wait done\n");
@@ -1571,24 +2674,23 @@ void SX128x::WriteRegister(uint16_t address, uint8_t value) {
 }
 
 void SX128x::ReadRegister(uint16_t address, uint8_t *buffer, uint16_t size) {
-	std::lock_guard<std::mutex> lg(IOLock);
+	if (InTransaction())
+		FlushTransaction();
 
-	WaitOnBusy();
+	// Opcode, address and NOP, then the register values
+	uint8_t header[4] = {RADIO_READ_REGISTER, static_cast<uint8_t>((address & 0xFF00) >> 8), static_cast<uint8_t>(address & 0x00FF), 0};
+	SpiIoVec_t iov[2] = {
+		{nullptr, header, 4},
+		{buffer, nullptr, size}
+	};
 
-	auto total_transfer_size = 4+size;
-	auto *buf_out = (uint8_t *)alloca(total_transfer_size);
-	auto *buf_in = (uint8_t *)alloca(total_transfer_size);
-
-	memset(buf_out, 0, total_transfer_size);
-	buf_out[0] = RADIO_READ_REGISTER;
-	buf_out[1] = ((address & 0xFF00) >> 8);
-	buf_out[2] = (address & 0x00FF);
+	std::lock_guard<std::mutex> lg(IOLock);
 
-	HalSpiTransfer(buf_in, buf_out, total_transfer_size);
+	WaitOnBusyUnlessIdle();
 
-	memcpy(buffer, buf_in+4, size);
+	HalSpiTransferV(iov, 2);
 
-	WaitOnBusy();
+	WaitOnBusy(RADIO_READ_REGISTER);
 }
 
 uint8_t SX128x::ReadRegister(uint16_t address) {
@@ -1599,41 +2701,41 @@ uint8_t SX128x::ReadRegister(uint16_t address) {
 }
 
 void SX128x::WriteBuffer(uint8_t offset, uint8_t *buffer, uint8_t size) {
-	std::lock_guard<std::mutex> lg(IOLock);
+	if (InTransaction())
+		FlushTransaction();
 
-	WaitOnBusy();
-
-	auto total_transfer_size = 2+size;
-	auto *buf_out = (uint8_t *)alloca(total_transfer_size);
+	uint8_t header[2] = {RADIO_WRITE_BUFFER, offset};
+	SpiIoVec_t iov[2] = {
+		{nullptr, header, 2},
+		{nullptr, buffer, size}
+	};
 
-	buf_out[0] = RADIO_WRITE_BUFFER;
-	buf_out[1] = offset;
+	std::lock_guard<std::mutex> lg(IOLock);
 
-	memcpy(buf_out+2, buffer, size);
+	WaitOnBusyUnlessIdle();
 
-	HalSpiWrite(buf_out, total_transfer_size);
+	HalSpiTransferV(iov, 2);
 
-	WaitOnBusy();
+	WaitOnBusy(RADIO_WRITE_BUFFER);
 }
 
 void SX128x::ReadBuffer(uint8_t offset, uint8_t *buffer, uint8_t size) {
-	std::lock_guard<std::mutex> lg(IOLock);
-
-	WaitOnBusy();
-
-	auto total_transfer_size = 3+size;
-	auto *buf_out = (uint8_t *)alloca(total_transfer_size);
-	auto *buf_in = (uint8_t *)alloca(total_transfer_size);
+	if (InTransaction())
+		FlushTransaction();
 
-	memset(buf_out, 0, total_transfer_size);
+	// Opcode, offset and NOP, then the data
+	uint8_t header[3] = {RADIO_READ_BUFFER, offset, 0};
+	SpiIoVec_t iov[2] = {
+		{nullptr, header, 3},
+		{buffer, nullptr, size}
+	};
 
-	buf_out[0] = RADIO_READ_BUFFER;
-	buf_out[1] = offset;
+	std::lock_guard<std::mutex> lg(IOLock);
 
-	HalSpiTransfer(buf_in, buf_out, total_transfer_size);
+	WaitOnBusyUnlessIdle();
 
-	memcpy(buffer, buf_in+3, size);
+	HalSpiTransferV(iov, 2);
 
-	WaitOnBusy();
+	WaitOnBusy(RADIO_READ_BUFFER);
 }
 
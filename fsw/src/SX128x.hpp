@@ -27,7 +27,10 @@
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <functional>
+#include <stdexcept>
+#include <exception>
 
 #include <cmath>
 #include <cstdio>
@@ -35,6 +38,15 @@
 #include <cstring>
 #include <cinttypes>
 
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#include <coroutine>
+#include <span>
+#include <exception>
+#define SX128X_HAS_COROUTINES	1
+#else
+#define SX128X_HAS_COROUTINES	0
+#endif
+
 
 /*!
  * \brief Represents the SX128x and its features
@@ -54,6 +66,49 @@ public:
 		 */
 		AUTO_TX_OFFSET = 33,
 
+		/*!
+		 * \brief Maximum number of commands queued in one SPI transaction
+		 */
+		SPI_BATCH_MAX_SEGMENTS = 16,
+
+		/*!
+		 * \brief Size of the byte pool holding the commands of one SPI transaction
+		 */
+		SPI_BATCH_MAX_BYTES = 256,
+
+		/*!
+		 * \brief BUSY time assumed for a command of a SPI transaction until it
+		 *        was measured, in microseconds
+		 *
+		 * \remark Covers the BUSY time of configuration commands in standby mode
+		 */
+		SPI_BATCH_BUSY_DELAY_US = 12,
+
+		/*!
+		 * \brief Maximum number of segments in one scatter-gather SPI transfer
+		 */
+		SPI_IOV_MAX_SEGMENTS = 4,
+
+		/*!
+		 * \brief Longest single block waiting for a BUSY falling edge in microseconds
+		 *
+		 * \remark The BUSY level is read again after each block, so a missed
+		 *         edge only costs this much
+		 */
+		BUSY_EDGE_WAIT_US = 2000,
+
+		/*!
+		 * \brief Commands expected to keep BUSY high up to this long are waited
+		 *        for by spinning on the BUSY level, in microseconds
+		 */
+		BUSY_SPIN_MAX_US = 20,
+
+		/*!
+		 * \brief Commands expected to keep BUSY high up to this long are waited
+		 *        for by yielding between reads, longer ones sleep, in microseconds
+		 */
+		BUSY_YIELD_MAX_US = 200,
+
 		/*!
 		 * \brief The address of the register holding the firmware version MSB
 		 */
@@ -618,6 +673,18 @@ public:
 		IRQ_RADIO_ALL = 0xFFFF,
 	} RadioIrqMasks_t;
 
+	enum {
+		//! IRQs a DIO line can report without a status read
+		IRQ_DIO_FAST_MASK = IRQ_TX_DONE | IRQ_RX_TX_TIMEOUT | IRQ_SYNCWORD_VALID | IRQ_HEADER_VALID | IRQ_PREAMBLE_DETECTED,
+	};
+
+	/*!
+	 * \brief IRQ masks of DIO1 to DIO3, as given to SetDioIrqParams( )
+	 */
+	typedef struct {
+		uint16_t Dio[3];
+	} DioPlan_t;
+
 	/*!
 	 * \brief Represents the digital input/output of the radio
 	 */
@@ -849,6 +916,19 @@ public:
 		};
 	} PacketStatus_t;
 
+	/*!
+	 * \brief Everything the IRQ service reads from the radio in one SPI transaction
+	 */
+	typedef struct {
+		uint16_t IrqRegs;                   //!< The IRQs raised, already cleared in the radio
+		uint8_t Length;                     //!< Payload length, 0 without IRQ_RX_DONE
+		uint8_t Offset;                     //!< Payload start in the data buffer
+		int8_t Rssi;                        //!< RSSI of the packet, RssiPkt in LoRa, RssiSync otherwise
+		int8_t Snr;                         //!< SNR of the packet, LoRa and ranging only
+		PacketStatus_t PacketStatus;
+		uint8_t Payload[255];
+	} RxCompletion_t;
+
 	/*!
 	 * \brief Represents the Rx internal counters values when GFSK or LORA packet type is used
 	 */
@@ -982,6 +1062,15 @@ public:
 		RADIO_SET_RANGING_ROLE = 0xA3,
 	} RadioCommands_t;
 
+	/*!
+	 * \brief BUSY duration statistics of a command, learned at runtime
+	 */
+	typedef struct {
+		uint32_t ExpectedNs;                //!< Exponentially weighted moving average of the BUSY time [ns]
+		uint32_t MaxNs;                     //!< Longest BUSY time seen [ns]
+		uint32_t Count;                     //!< Number of samples
+	} BusyStat_t;
+
 	/*!
 	 * \brief Radio registers definition
 	 *
@@ -1047,13 +1136,119 @@ const RadioRegisters_t RadioRegsInit[1] = {0,0}; //cfs
 
 	virtual uint8_t HalGpioRead(GpioPinFunction_t func) = 0;
 
+	/*!
+	 * \brief Returns the DIO lines wired to IRQ handlers, bit 0 for DIO1
+	 */
+	virtual uint8_t HalDioLines(void) {
+		return 0x01;
+	}
+
 	virtual void HalGpioWrite(GpioPinFunction_t func, uint8_t value) = 0;
 
+	/*!
+	 * \brief Blocks until a falling edge on the pin or until the timeout expires
+	 *
+	 * \param [in]  func          The pin to wait on
+	 * \param [in]  timeoutUs     Longest time to block in microseconds
+	 *
+	 * \retval      supported     false if the HAL has no edge events for this pin,
+	 *                            the driver then polls it with HalGpioRead( )
+	 */
+	virtual bool HalGpioWaitFallingEdge(GpioPinFunction_t /*func*/, uint32_t /*timeoutUs*/) {
+		return false;
+	}
+
 	virtual void HalSpiTransfer(uint8_t *buffer_in, const uint8_t *buffer_out, uint16_t size) = 0;
 
-	void HalSpiRead(uint8_t *buffer_in, uint16_t size);
+	/*!
+	 * \brief Receives size bytes while sending zeros
+	 *
+	 * The default implementation clears buffer_in and uses it for both
+	 * directions. Override it when the bus can receive without a transmit buffer.
+	 */
+	virtual void HalSpiRead(uint8_t *buffer_in, uint16_t size);
 
-	void HalSpiWrite(const uint8_t *buffer_out, uint16_t size);
+	/*!
+	 * \brief Sends size bytes and discards what is received
+	 *
+	 * Override it when the bus can send without a receive buffer.
+	 */
+	virtual void HalSpiWrite(const uint8_t *buffer_out, uint16_t size);
+
+	/*!
+	 * \brief Describes one segment of a scatter-gather SPI transfer
+	 */
+	typedef struct {
+		uint8_t *buffer_in;                 //!< Receive buffer, nullptr to discard the received data
+		const uint8_t *buffer_out;          //!< Transmit buffer, nullptr to send zeros
+		uint16_t size;                      //!< Segment size in bytes
+	} SpiIoVec_t;
+
+	/*!
+	 * \brief Sends the segments back to back with chip select held for the
+	 *        whole transfer
+	 *
+	 * Lets a command header and the caller's payload go out without merging
+	 * them first. The default implementation gathers the segments in a
+	 * temporary buffer and uses HalSpiTransfer( ).
+	 *
+	 * \param [in]  iov           Segments, at most SPI_IOV_MAX_SEGMENTS, std::length_error beyond
+	 * \param [in]  count         Number of segments
+	 */
+	virtual void HalSpiTransferV(const SpiIoVec_t *iov, size_t count);
+
+	/*!
+	 * \brief Describes one chip select framed transfer of a SPI transaction
+	 */
+	typedef struct {
+		uint8_t *buffer_in;                 //!< Receive buffer, nullptr for write only transfers
+		const uint8_t *buffer_out;          //!< Transmit buffer
+		uint16_t size;                      //!< Transfer size in bytes
+		uint16_t delay_usecs;               //!< BUSY time of the command, to let pass after chip select is released
+	} SpiSegment_t;
+
+	/*!
+	 * \brief Sends several chip select framed transfers
+	 *
+	 * The default implementation sends the transfers one by one and waits on
+	 * BUSY in between. Implementations able to toggle chip select inside one
+	 * SPI message should override it, and wait on BUSY wherever the gap
+	 * between two transfers is shorter than delay_usecs.
+	 *
+	 * \param [in]  segments      Transfers to be sent, in order
+	 * \param [in]  count         Number of transfers
+	 */
+	virtual void HalSpiTransferBatch(const SpiSegment_t *segments, size_t count);
+
+	typedef enum {
+		RF_PATH_OFF,
+		RF_PATH_TX,
+		RF_PATH_RX
+	} RfPath_t;
+
+	/*!
+	 * \brief Sets the external RF switch for the next operation
+	 *
+	 * The default implementation calls HalPostRx/HalPreTx, HalPostTx/HalPreRx
+	 * or both post hooks. Override it when both switch lines can be set at once.
+	 *
+	 * \param [in]  path          The RF path to select
+	 */
+	virtual void HalSetRfPath(RfPath_t path);
+
+	typedef enum {
+		IRQ_STAGE_STATUS_READ,	//!< The IRQ status is read and cleared
+		IRQ_STAGE_CALLBACK	//!< The first handler is about to be called
+	} IrqStage_t;
+
+	/*!
+	 * \brief Marks the progress of IRQ processing, for latency instrumentation
+	 *
+	 * \param [in]  stage         The stage reached
+	 */
+	virtual void HalIrqStage(IrqStage_t /*stage*/) {
+
+	}
 
 	virtual void HalPreTx() {
 
@@ -1125,6 +1320,141 @@ const RadioRegisters_t RadioRegsInit[1] = {0,0}; //cfs
 
 	} callbacks;
 
+	/*!
+	 * \brief Handler slots of the IRQ dispatch tables, one per callback
+	 */
+	typedef enum {
+		IRQ_SLOT_TX_DONE,
+		IRQ_SLOT_RX_DONE,
+		IRQ_SLOT_RX_SYNCWORD_DONE,
+		IRQ_SLOT_RX_HEADER_DONE,
+		IRQ_SLOT_TX_TIMEOUT,
+		IRQ_SLOT_RX_TIMEOUT,
+		IRQ_SLOT_RX_ERROR,
+		IRQ_SLOT_RANGING_DONE,
+		IRQ_SLOT_CAD_DONE,
+	} IrqSlot_t;
+
+	/*!
+	 * \brief One entry of the IRQ dispatch table of a (packet type, operating mode) pair
+	 */
+	typedef struct {
+		uint16_t Mask;                      //!< IRQ bits that must all be set, 0 ends the table
+		uint16_t Exclude;                   //!< IRQ bits that must all be clear
+		uint8_t Slot;                       //!< The IrqSlot_t to call
+		uint8_t Arg;                        //!< Error code, ranging code or CAD flag passed to the handler
+		bool RfOff;                         //!< Turns the RF switch off before calling the handler
+	} IrqRule_t;
+
+	/*!
+	 * \brief Base of the listeners given to ProcessIrqs( Listener& )
+	 *
+	 * Listeners derive from it and hide the handlers they need. Calls are
+	 * resolved at compile time, so handlers can be inlined into the dispatch.
+	 */
+	struct IrqListener {
+		void OnTxDone() {}
+		void OnRxDone() {}
+		void OnRxSyncWordDone() {}
+		void OnRxHeaderDone() {}
+		void OnTxTimeout() {}
+		void OnRxTimeout() {}
+		void OnRxError(IrqErrorCode_t /*errCode*/) {}
+		void OnRangingDone(IrqRangingCode_t /*val*/) {}
+		void OnCadDone(bool /*cadFlag*/) {}
+	};
+
+	typedef struct {
+		double TableNs;                     //!< Per IRQ, through a listener inlined into the dispatch
+		double CallbacksNs;                 //!< Per IRQ, through the std::function callbacks
+	} IrqDispatchBenchmark_t;
+
+#if SX128X_HAS_COROUTINES
+	/*!
+	 * \brief Outcome of an awaited radio operation
+	 */
+	typedef enum {
+		RADIO_OP_DONE,
+		RADIO_OP_TIMEOUT,
+		RADIO_OP_ERROR,                     //!< Reception failed, see Error
+		RADIO_OP_OVERFLOW,                  //!< The received payload didn't fit the buffer
+	} RadioOpStatus_t;
+
+	typedef struct {
+		RadioOpStatus_t Status;
+		IrqErrorCode_t Error;               //!< Valid with RADIO_OP_ERROR
+		uint8_t Size;                       //!< Size of the received payload
+		bool CadDetected;                   //!< Channel activity seen by Cad( )
+	} RadioOpResult_t;
+
+	/*!
+	 * \brief Awaitable radio operation, resumed from ProcessIrqs( )
+	 *
+	 * Operations awaited while another one is in flight are queued and
+	 * started in order. The callbacks still run before the awaiting
+	 * coroutine is resumed.
+	 */
+	class RadioOp {
+	public:
+		RadioOp(const RadioOp&) = delete;
+		RadioOp& operator=(const RadioOp&) = delete;
+
+		bool await_ready() const noexcept {
+			return false;
+		}
+
+		bool await_suspend(std::coroutine_handle<> handle);
+
+		RadioOpResult_t await_resume() const {
+			if (Failure)
+				std::rethrow_exception(Failure);
+			return Result;
+		}
+
+	private:
+		friend class SX128x;
+
+		typedef enum {
+			OP_TX,
+			OP_RX,
+			OP_CAD
+		} Kind_t;
+
+		RadioOp(SX128x& radio, Kind_t kind, std::span<uint8_t> buffer, TickTime_t timeout) :
+			Radio(radio), Kind(kind), Buffer(buffer), Timeout(timeout) {}
+
+		SX128x& Radio;
+		Kind_t Kind;
+		std::span<uint8_t> Buffer;
+		TickTime_t Timeout;
+		RadioOpResult_t Result{};
+		std::exception_ptr Failure;
+		std::coroutine_handle<> Handle;
+		RadioOp *Next = nullptr;
+	};
+
+	/*!
+	 * \brief Sends a payload, co_await it for the Tx done or timeout interrupt
+	 *
+	 * \param [in]  payload       The payload to send, must outlive the operation
+	 * \param [in]  timeout       The timeout for Tx operation
+	 */
+	RadioOp Transmit(std::span<const uint8_t> payload, TickTime_t timeout);
+
+	/*!
+	 * \brief Receives a payload, co_await it for the Rx done, error or timeout interrupt
+	 *
+	 * \param [out] buffer        Receives the payload, must outlive the operation
+	 * \param [in]  timeout       The timeout for Rx operation
+	 */
+	RadioOp Receive(std::span<uint8_t> buffer, TickTime_t timeout);
+
+	/*!
+	 * \brief Runs a Channel Activity Detection, co_await it for the CAD done interrupt
+	 */
+	RadioOp Cad(void);
+#endif
+
 	/*!
 	 * \brief Instantiates a SX1280 object and provides API functions to communicates with the radio
 	 *
@@ -1135,6 +1465,317 @@ const RadioRegisters_t RadioRegsInit[1] = {0,0}; //cfs
 
 private:
 	std::mutex IOLock, IOLock2;
+
+#if SX128X_HAS_COROUTINES
+	/*!
+	 * \brief Queue of awaited operations, the head one is in flight
+	 */
+	std::mutex OpLock;
+	RadioOp *OpHead = nullptr, *OpTail = nullptr;
+
+	/*!
+	 * \brief Unlinks the head operation and returns the next one, OpLock must be held
+	 */
+	RadioOp *PopRadioOp(void);
+
+	/*!
+	 * \brief Starts op, and the ones behind it while they fail to start
+	 *
+	 * \retval      failed        true if self failed to start, it's then left for the caller to resume
+	 */
+	bool StartRadioOps(RadioOp *op, RadioOp *self);
+
+	/*!
+	 * \brief Completes the operation in flight if irqRegs ends it
+	 */
+	void ResumeRadioOp(uint16_t irqRegs);
+#endif
+
+	/*!
+	 * \brief BUSY duration statistics indexed by opcode
+	 */
+	BusyStat_t BusyStats[256] = {};
+
+	/*!
+	 * \brief Adds a BUSY duration sample of a command to its statistics
+	 */
+	void UpdateBusyStat(RadioCommands_t opcode, uint32_t busyNs);
+
+	/*!
+	 * \brief Tracks whether BUSY is known to be low before a command
+	 */
+	struct {
+		bool Low = false;                           //!< BUSY was seen low after the last command
+		bool Autonomous = false;                    //!< The radio is in a mode it leaves on its own (Rx, Tx, CAD)
+	} BusyIdle;
+
+	/*!
+	 * \brief Waits on BUSY before a command, unless the radio is provably idle
+	 */
+	void WaitOnBusyUnlessIdle(void);
+
+	/*!
+	 * \brief Serializes SPI transactions and records the thread queueing commands
+	 */
+	std::mutex BatchLock;
+	std::atomic<std::thread::id> BatchOwner{};
+
+	/*!
+	 * \brief Commands queued by the current SPI transaction
+	 */
+	SpiSegment_t BatchSegments[SPI_BATCH_MAX_SEGMENTS];
+	uint8_t BatchBytes[SPI_BATCH_MAX_BYTES];
+	size_t BatchSegmentCount = 0;
+	size_t BatchBytesUsed = 0;
+	uint16_t BatchBusyDelay = SPI_BATCH_BUSY_DELAY_US;
+
+	/*!
+	 * \brief BUSY time to let pass after a command of a SPI transaction
+	 */
+	uint16_t BatchDelay(uint8_t opcode) const;
+
+	/*!
+	 * \brief Returns true if the calling thread has an open SPI transaction
+	 */
+	bool InTransaction(void) const;
+
+	/*!
+	 * \brief Returns true if the command can be queued in a SPI transaction
+	 *
+	 * Commands changing the operating mode, calibrating or saving the context
+	 * keep BUSY high for too long and are always sent immediately.
+	 */
+	static bool IsBatchable(RadioCommands_t opcode);
+
+	/*!
+	 * \brief Queues a command made of a header and a payload in the SPI transaction
+	 *
+	 * \retval      queued        false if the command is larger than the transaction pool
+	 */
+	bool QueueTransfer(const uint8_t *header, uint16_t headerSize, const uint8_t *payload, uint16_t size);
+
+	/*!
+	 * \brief Sends the commands queued so far in the SPI transaction
+	 */
+	void FlushTransaction(void);
+	/*!
+	 * \brief Reads and clears the IRQ status
+	 *
+	 * \param [out] packetType    The packet type the IRQs belong to
+	 * \param [in]  leave         IRQs neither cleared nor returned
+	 *
+	 * \retval      irqRegs       The IRQs raised
+	 */
+	uint16_t FetchIrqs(RadioPacketTypes_t &packetType, uint16_t leave = 0);
+
+	/*!
+	 * \brief ServiceIrqs( ) leaving the IRQs of leave set and out of rx.IrqRegs
+	 */
+	void ServiceIrqs(RxCompletion_t &rx, uint8_t prefetch, uint16_t leave);
+
+	/*!
+	 * \brief ProcessIrqs( ) leaving the IRQs of leave to their DIO lines
+	 */
+	void ProcessIrqsExcept(uint16_t leave);
+
+	/*!
+	 * \brief Returns the dispatch table of a packet type and operating mode
+	 */
+	static const IrqRule_t *IrqRules(RadioPacketTypes_t packetType, RadioOperatingModes_t mode);
+
+	/*!
+	 * \brief Calls the handlers the rules select for irqRegs
+	 *
+	 * Only calls handlers, the radio is left alone apart from the RF path.
+	 * keepRfPath skips turning it off, see AdvanceStreams( ).
+	 */
+	template <class Listener>
+	void DispatchIrqs(Listener &listener, const IrqRule_t *rule, uint16_t irqRegs, bool keepRfPath = false) {
+		bool staged = false;
+
+		for (; rule->Mask; rule++) {
+			if (( irqRegs & rule->Mask ) != rule->Mask || ( irqRegs & rule->Exclude ))
+				continue;
+
+			if (!staged) {
+				HalIrqStage(IRQ_STAGE_CALLBACK);
+				staged = true;
+			}
+
+			if (rule->RfOff && !keepRfPath)
+				HalSetRfPath(RF_PATH_OFF);
+
+			switch (rule->Slot) {
+				case IRQ_SLOT_TX_DONE:
+					listener.OnTxDone();
+					break;
+				case IRQ_SLOT_RX_DONE:
+					listener.OnRxDone();
+					break;
+				case IRQ_SLOT_RX_SYNCWORD_DONE:
+					listener.OnRxSyncWordDone();
+					break;
+				case IRQ_SLOT_RX_HEADER_DONE:
+					listener.OnRxHeaderDone();
+					break;
+				case IRQ_SLOT_TX_TIMEOUT:
+					listener.OnTxTimeout();
+					break;
+				case IRQ_SLOT_RX_TIMEOUT:
+					listener.OnRxTimeout();
+					break;
+				case IRQ_SLOT_RX_ERROR:
+					listener.OnRxError(static_cast<IrqErrorCode_t>(rule->Arg));
+					break;
+				case IRQ_SLOT_RANGING_DONE:
+					listener.OnRangingDone(static_cast<IrqRangingCode_t>(rule->Arg));
+					break;
+				case IRQ_SLOT_CAD_DONE:
+					listener.OnCadDone(rule->Arg != 0);
+					break;
+			}
+		}
+	}
+
+	/*!
+	 * \brief Listener forwarding to a set of std::function callbacks
+	 */
+	template <class Callbacks>
+	struct CallbackListener : IrqListener {
+		Callbacks &cb;
+
+		void OnTxDone() { if (cb.txDone) cb.txDone(); }
+		void OnRxDone() { if (cb.rxDone) cb.rxDone(); }
+		void OnRxSyncWordDone() { if (cb.rxSyncWordDone) cb.rxSyncWordDone(); }
+		void OnRxHeaderDone() { if (cb.rxHeaderDone) cb.rxHeaderDone(); }
+		void OnTxTimeout() { if (cb.txTimeout) cb.txTimeout(); }
+		void OnRxTimeout() { if (cb.rxTimeout) cb.rxTimeout(); }
+		void OnRxError(IrqErrorCode_t errCode) { if (cb.rxError) cb.rxError(errCode); }
+		void OnRangingDone(IrqRangingCode_t val) { if (cb.rangingDone) cb.rangingDone(val); }
+		void OnCadDone(bool cadFlag) { if (cb.cadDone) cb.cadDone(cadFlag); }
+	};
+
+	/*!
+	 * \brief Decodes the response of RADIO_GET_PACKETSTATUS
+	 */
+	static void DecodePacketStatus(RadioPacketTypes_t packetType, const uint8_t *status, PacketStatus_t *packetStatus);
+
+	/*!
+	 * \brief Encodes the arguments of RADIO_SET_PACKETPARAMS
+	 */
+	static void EncodePacketParams(const PacketParams_t &packetParams, uint8_t *buf);
+
+	/*!
+	 * \brief Points the Tx base address to a buffer half and starts Tx, in
+	 *        one SPI transaction
+	 *
+	 * \param [in]  fresh         Clears the IRQs first and sets the ranging role like SetTx( ),
+	 *                            false when chained from TxDone
+	 */
+	void StartStreamTx(uint8_t half, uint8_t size, bool fresh);
+
+	/*!
+	 * \brief Sets back the Tx base address kept by StartTxStream( )
+	 */
+	void RestoreTxBase(void);
+
+	void StartTxStream(TickTime_t timeout, bool idleRx, TickTime_t idleRxTimeout);
+
+	/*!
+	 * \brief Called on TxDone and TxTimeout, starts the frame waiting in the
+	 *        idle half if any
+	 *
+	 * \retval      started       True when a new frame is on air
+	 */
+	bool TxStreamNext(void);
+
+	/*!
+	 * \brief Called on RxDone, queues the packet received in continuous Rx and
+	 *        moves the Rx base address to the next buffer slot
+	 *
+	 * \param [in]  irqRegs       The IRQs raised with RxDone
+	 */
+	void ContinuousRxNext(uint16_t irqRegs);
+
+	/*!
+	 * \brief Moves the continuous Rx and the Tx stream on for the IRQs raised,
+	 *        before their handlers run
+	 *
+	 * \retval      streamed      True when a streamed frame was started, the RF path stays on
+	 */
+	bool AdvanceStreams(uint16_t irqRegs);
+
+	/*!
+	 * \brief Packet slot of the Rx ring, aligned so neighbours don't share cache lines
+	 */
+	struct alignas(64) RxSlot_t {
+		RxCompletion_t Rx;
+	};
+
+	/*!
+	 * \brief The Rx ring, IRQ thread producing and one consumer
+	 */
+	std::unique_ptr<RxSlot_t[]> RxSlots;
+	size_t RxSlotMask = 0;
+	uint8_t RxPrefetch = 0;
+	alignas(64) std::atomic<size_t> RxHead{0};
+	alignas(64) std::atomic<size_t> RxTail{0};
+	std::atomic<uint32_t> RxDropped{0};
+
+	/*!
+	 * \brief IRQ masks of the DIO lines, and the IRQs ProcessDioIrq( ) owns
+	 */
+	uint16_t DioMasks[3] = { 0, 0, 0 };
+	uint16_t DioFastMask = 0;
+
+	/*!
+	 * \brief The Rx base address last set with SetBufferBaseAddresses( )
+	 */
+	uint8_t RxBaseAddress = 0;
+
+	/*!
+	 * \brief Streaming Tx state, the halves are -1 when unused
+	 */
+	std::mutex TxStreamLock;
+	bool TxStreamActive = false;
+	TickTime_t TxStreamTimeout = {};
+	bool TxStreamIdleRx = false;
+	TickTime_t TxStreamRxTimeout = {};
+	int8_t TxOnAir = -1;
+	int8_t TxReady = -1;
+	uint8_t TxReadySize = 0;
+	bool TxUploading = false;
+
+	/*!
+	 * \brief The Tx base address last set, by SetBufferBaseAddresses( ) or a
+	 *        streamed frame, and the one the stream restores when it ends
+	 */
+	uint8_t TxBaseAddress = 0;
+	uint8_t TxStreamBase = 0;
+
+	/*!
+	 * \brief A packet of continuous Rx waiting in its buffer slot
+	 */
+	typedef struct {
+		uint8_t Offset;
+		uint8_t Length;
+		PacketStatus_t PacketStatus;
+	} ContinuousRxPacket_t;
+
+	/*!
+	 * \brief Continuous Rx state, RxcQueue holds the filled slots oldest first
+	 */
+	std::mutex RxcLock;
+	bool RxcActive = false;
+	uint8_t RxcSlots = 0;
+	uint8_t RxcSlotSize = 0;
+	uint8_t RxcSlot = 0;
+	ContinuousRxPacket_t RxcQueue[8];
+	uint8_t RxcHead = 0;
+	uint8_t RxcCount = 0;
+	uint32_t RxcOverruns = 0;
+	uint32_t RxcOversized = 0;
+
 	/*!
 	 * \brief Holds the internal operating mode of the radio
 	 */
@@ -1289,6 +1930,109 @@ public:
 
 	void WaitOnBusyLong();
 
+	/*!
+	 * \brief Waits for the BUSY period following a command
+	 *
+	 * The wait strategy follows the BUSY duration learned for the opcode:
+	 * short ones are spun on, medium ones yield between reads and long or
+	 * unknown ones block like WaitOnBusy( ). The measured duration updates
+	 * the statistics of the opcode.
+	 *
+	 * \param [in]  opcode        The command just sent
+	 */
+	void WaitOnBusy(RadioCommands_t opcode);
+
+	/*!
+	 * \brief Returns the BUSY duration statistics learned for a command
+	 *
+	 * \param [in]  opcode        Command opcode
+	 *
+	 * \retval      stat          Expected and worst BUSY time, sample count
+	 */
+	BusyStat_t GetBusyStat(RadioCommands_t opcode);
+
+	/*!
+	 * \brief Forgets the learned BUSY durations
+	 */
+	void ResetBusyStats(void);
+
+	/*!
+	 * \brief Starts queueing configuration commands issued by the calling thread
+	 *
+	 * Until CommitTransaction( ) is called, WriteCommand( ) and WriteRegister( )
+	 * are queued and sent together in one SPI submission. Reads and commands
+	 * changing the operating mode send the queued commands first, so the order
+	 * seen by the radio is preserved.
+	 * @code
+	 * radio.BeginTransaction( );
+	 * radio.SetPacketType( SX128x::PACKET_TYPE_LORA );
+	 * radio.SetModulationParams( modulationParams );
+	 * radio.SetPacketParams( packetParams );
+	 * radio.SetRfFrequency( 2400000000 );
+	 * radio.CommitTransaction( );
+	 * @endcode
+	 *
+	 * \remark Transactions do not nest. Other threads starting a transaction
+	 *         block until this one is committed.
+	 */
+	void BeginTransaction(void);
+
+	/*!
+	 * \brief Sends the commands queued since BeginTransaction( ) and ends the transaction
+	 */
+	void CommitTransaction(void);
+
+	/*!
+	 * \brief Sets the BUSY time assumed for the commands of a SPI transaction
+	 *        whose BUSY time wasn't measured yet
+	 *
+	 * Measured ones get twice their expected time, see GetBusyStat( ).
+	 *
+	 * \param [in]  usecs         Delay in microseconds, see SPI_BATCH_BUSY_DELAY_US
+	 */
+	void SetTransactionBusyDelay(uint16_t usecs);
+
+	/*!
+	 * \brief Holds a SPI transaction open for its scope
+	 *
+	 * Commits on the way out. Left by an exception, the queued commands are
+	 * dropped instead. The transaction lock is released either way.
+	 * @code
+	 * {
+	 *     SX128x::Transaction t( radio );
+	 *     radio.SetPacketType( SX128x::PACKET_TYPE_LORA );
+	 *     radio.SetModulationParams( modulationParams );
+	 * }
+	 * @endcode
+	 */
+	class Transaction {
+	public:
+		explicit Transaction(SX128x &radio) : Radio(radio) {
+			Radio.BeginTransaction();
+		}
+
+		Transaction(const Transaction&) = delete;
+		Transaction& operator=(const Transaction&) = delete;
+
+		~Transaction() noexcept(false) {
+			// Unwinding already, a second exception would terminate
+			if (std::uncaught_exceptions() > Unwinding)
+				Radio.AbortTransaction();
+			else
+				Radio.CommitTransaction();
+		}
+
+	private:
+		SX128x &Radio;
+		int Unwinding = std::uncaught_exceptions();
+	};
+
+	/*!
+	 * \brief Ends the transaction without sending the commands queued since
+	 *        BeginTransaction( )
+	 */
+	void AbortTransaction(void);
+
 	/*!
 	 * \brief Resets the radio
 	 */
@@ -1571,6 +2315,40 @@ public:
 	 */
 	void SetDioIrqParams(uint16_t irqMask, uint16_t dio1Mask, uint16_t dio2Mask, uint16_t dio3Mask);
 
+	/*!
+	 * \brief Spreads the IRQs over the wired DIO lines
+	 *
+	 * TxDone, then RxTxTimeout, get a line of their own while more than one
+	 * line is left. The last line carries the remaining IRQs.
+	 *
+	 * \param [in]  irqMask       General IRQ mask
+	 * \param [in]  dioLines      Wired DIO lines, bit 0 for DIO1
+	 *
+	 * \retval      plan          The DIO masks
+	 */
+	static DioPlan_t PlanDioIrqs(uint16_t irqMask, uint8_t dioLines);
+
+	/*!
+	 * \brief Sets the IRQ mask and DIO masks planned by PlanDioIrqs( ) for
+	 *        the lines reported by HalDioLines( )
+	 *
+	 * \param [in]  irqMask       General IRQ mask
+	 */
+	void SetDioIrqRouting(uint16_t irqMask);
+
+	/*!
+	 * \brief Processes an edge on a DIO line
+	 *
+	 * When the line carries a single IRQ of IRQ_DIO_FAST_MASK, the IRQ is
+	 * read and cleared in one batch and dispatched if set, without the packet
+	 * reads. Otherwise the IRQs are processed as by ProcessIrqs( ), leaving
+	 * the ones with a line of their own to it. ProcessIrqs( ) itself reports
+	 * every IRQ.
+	 *
+	 * \param [in]  dio           GPIO_PIN_DIO1, GPIO_PIN_DIO2 or GPIO_PIN_DIO3
+	 */
+	void ProcessDioIrq(GpioPinFunction_t dio);
+
 	/*!
 	 * \brief Returns the current IRQ status
 	 *
@@ -1662,6 +2440,116 @@ public:
 	 */
 	void SendPayload(uint8_t *payload, uint8_t size, TickTime_t timeout, uint8_t offset = 0x00);
 
+	enum {
+		//! Largest frame of a Tx stream, half of the data buffer
+		TX_STREAM_MAX_SIZE = 128,
+	};
+
+	/*!
+	 * \brief Starts streaming Tx
+	 *
+	 * The data buffer is split in two halves. QueueTx( ) uploads the next
+	 * frame into the idle half while the current one is on air, so TxDone
+	 * only has to switch the Tx base address and restart Tx. The payload
+	 * length is updated along when frame sizes differ.
+	 *
+	 * \param [in]  timeout       The timeout for each Tx operation
+	 */
+	void StartTxStream(TickTime_t timeout);
+
+	/*!
+	 * \brief Starts streaming Tx, the radio listening while no frame is on air
+	 *
+	 * Rx starts now unless a frame is on air, and again whenever the stream
+	 * runs dry, as part of the TxDone or timeout processing. That's done under
+	 * the stream lock, so it never aborts a frame QueueTx( ) started. A frame
+	 * queued while in Rx aborts a reception in progress, as SetTx( ) would.
+	 *
+	 * \param [in]  timeout       The timeout for each Tx operation
+	 * \param [in]  idleRxTimeout The Rx timeout, RX_TX_CONTINUOUS to stay in Rx
+	 */
+	void StartTxStream(TickTime_t timeout, TickTime_t idleRxTimeout);
+
+	/*!
+	 * \brief Queues a frame of a Tx stream
+	 *
+	 * The frame is sent at once when nothing is on air, otherwise after the
+	 * current one.
+	 *
+	 * \param [in]  payload       A pointer to the payload to send
+	 * \param [in]  size          The size of the payload, up to TX_STREAM_MAX_SIZE
+	 *
+	 * \retval      queued        False when a frame is already waiting
+	 */
+	bool QueueTx(const uint8_t *payload, uint8_t size);
+
+	/*!
+	 * \brief Returns the frames of the Tx stream on air or waiting
+	 */
+	uint8_t GetTxStreamDepth(void);
+
+	/*!
+	 * \brief Stops streaming Tx, a frame waiting is dropped and the one on air
+	 *        completes
+	 *
+	 * The Tx base address set before the stream started is restored once no
+	 * frame is on air.
+	 */
+	void StopTxStream(void);
+
+	/*!
+	 * \brief Starts continuous Rx
+	 *
+	 * The data buffer is split in slots of at least maxSize bytes, up to 8.
+	 * On each RxDone the Rx base address moves to the next slot while the
+	 * radio stays in Rx, so packets are never lost to a re-arm and the host
+	 * can read them later with ReadContinuousRx( ). When the host falls
+	 * behind, the oldest packet is overwritten and counted as an overrun.
+	 *
+	 * With a GFSK or FLRC variable length header, maxSize is programmed as
+	 * the largest payload. Packets longer than a slot that still get through,
+	 * e.g. in LoRa, are dropped and counted along with the queued packets they
+	 * overwrote.
+	 *
+	 * \param [in]  maxSize       Largest expected payload, up to 128
+	 */
+	void StartContinuousRx(uint8_t maxSize);
+
+	/*!
+	 * \brief Reads the oldest packet received in continuous Rx
+	 *
+	 * \param [out] payload       A pointer to a buffer into which the payload will be copied
+	 * \param [in]  maxSize       The size of payload, longer packets are truncated
+	 * \param [out] size          The length of the packet received
+	 * \param [out] packetStatus  The status of the packet, may be null
+	 *
+	 * \retval      read          False when no packet is waiting
+	 */
+	bool ReadContinuousRx(uint8_t *payload, uint8_t maxSize, uint8_t *size, PacketStatus_t *packetStatus = nullptr);
+
+	/*!
+	 * \brief Returns the packets of continuous Rx waiting to be read
+	 */
+	uint8_t GetContinuousRxPending(void);
+
+	/*!
+	 * \brief Returns the packets overwritten before being read since
+	 *        StartContinuousRx( )
+	 */
+	uint32_t GetContinuousRxOverruns(void);
+
+	/*!
+	 * \brief Returns the packets of continuous Rx dropped for being longer
+	 *        than a slot since StartContinuousRx( )
+	 */
+	uint32_t GetContinuousRxOversized(void);
+
+	/*!
+	 * \brief Stops continuous Rx and puts the radio in STDBY_RC, packets not
+	 *        read are dropped
+	 */
+	void StopContinuousRx(void);
+
 	/*!
 	 * \brief Sets the Sync Word given by index used in GFSK, FLRC and BLE protocols
 	 *
@@ -1852,6 +2740,102 @@ public:
 	 */
 	void ProcessIrqs();
 
+	/*!
+	 * \brief Process the analysis of radio IRQs and calls the handlers of
+	 *        listener depending on radio state
+	 *
+	 * \param [in]  listener      An IrqListener derived object
+	 */
+	template <class Listener>
+	void ProcessIrqs(Listener &listener) {
+		RadioPacketTypes_t packetType;
+		uint16_t irqRegs = FetchIrqs(packetType);
+		const IrqRule_t *rules = IrqRules(packetType, OperatingMode);
+
+		DispatchIrqs(listener, rules, irqRegs, AdvanceStreams(irqRegs));
+
+#if SX128X_HAS_COROUTINES
+		ResumeRadioOp(irqRegs);
+#endif
+	}
+
+	/*!
+	 * \brief Reads and clears the IRQs and reads the reception metadata and
+	 *        payload in one SPI transaction
+	 *
+	 * GetIrqStatus, ClearIrqStatus, GetRxBufferStatus, GetPacketStatus and the
+	 * LoRa length registers are sent as one batch. With prefetch set, up to
+	 * prefetch payload bytes are read from the Rx base address in the same
+	 * batch, longer payloads take a second transaction for the rest.
+	 *
+	 * \param [out] rx            The IRQs and received packet
+	 * \param [in]  prefetch      Payload bytes to read along, 0 to read the payload separately
+	 */
+	void ServiceIrqs(RxCompletion_t &rx, uint8_t prefetch = 0);
+
+	/*!
+	 * \brief Services the radio IRQs with ServiceIrqs( ) and calls the handlers
+	 *        of listener depending on radio state
+	 *
+	 * Handlers find the received packet in rx.
+	 *
+	 * \param [in]  listener      An IrqListener derived object
+	 * \param [out] rx            The IRQs and received packet
+	 * \param [in]  prefetch      Payload bytes to read along with the IRQ status
+	 */
+	template <class Listener>
+	void ProcessIrqs(Listener &listener, RxCompletion_t &rx, uint8_t prefetch = 0) {
+		ServiceIrqs(rx, prefetch);
+		const IrqRule_t *rules = IrqRules(PacketType, OperatingMode);
+
+		DispatchIrqs(listener, rules, rx.IrqRegs, AdvanceStreams(rx.IrqRegs));
+
+#if SX128X_HAS_COROUTINES
+		ResumeRadioOp(rx.IrqRegs);
+#endif
+	}
+
+	/*!
+	 * \brief Makes ProcessIrqs( ) store received packets in a ring
+	 *
+	 * Each packet is serviced with ServiceIrqs( ) straight into the next free
+	 * slot before the callbacks run, so rxDone may re-arm Rx right away.
+	 * Packets received while the ring is full are counted and dropped
+	 * without rxDone, so a consumer re-arming Rx from rxDone has to do it
+	 * once it has drained the ring, see GetRxDropped( ).
+	 * Call it before IRQs are processed.
+	 *
+	 * \param [in]  slots         Number of packet slots, a power of 2
+	 * \param [in]  prefetch      Payload bytes read along with the IRQ status, see ServiceIrqs( )
+	 */
+	void EnableRxRing(size_t slots, uint8_t prefetch = 0);
+
+	/*!
+	 * \brief Returns the oldest received packet, nullptr if there is none
+	 *
+	 * The slot stays valid until PopRx( ). Only one consumer thread may call
+	 * PeekRx( ) and PopRx( ). Each rxDone has its packet here, packets
+	 * dropped while the ring was full have none.
+	 */
+	const RxCompletion_t *PeekRx(void);
+
+	/*!
+	 * \brief Releases the packet returned by PeekRx( ), does nothing when the ring is empty
+	 */
+	void PopRx(void);
+
+	/*!
+	 * \brief Returns the number of packets dropped because the ring was full
+	 */
+	uint32_t GetRxDropped(void) const;
+
+	/*!
+	 * \brief Measures the dispatch cost per IRQ, without any SPI access
+	 *
+	 * \param [in]  iterations    Number of IRQs dispatched on each path
+	 */
+	IrqDispatchBenchmark_t BenchmarkIrqDispatch(uint32_t iterations = 100000);
+
 	/*!
 	 * \brief Force the preamble length in GFSK and BLE mode
 	 *
@@ -1862,5 +2846,31 @@ public:
 	static uint16_t GetTimeOnAir(const ModulationParams_t &modparams, const PacketParams_t &pktparams);
 
 	uint16_t GetTimeOnAir();
+
+	/*!
+	 * \brief Time on air in ms of a packet of the given payload length with the current parameters
+	 *
+	 * \param [in]  payloadLength The payload length in bytes
+	 */
+	uint16_t GetTimeOnAir(uint8_t payloadLength);
+
+	/*!
+	 * \brief Same as GetTimeOnAir( payloadLength ) in us, FLRC and short GFSK
+	 *        frames take well under a ms
+	 *
+	 * \param [in]  payloadLength The payload length in bytes
+	 */
+	uint32_t GetTimeOnAirUs(uint8_t payloadLength);
+
+private:
+	/*!
+	 * \brief Unrounded time on air in ms, 2000 for the packet types it doesn't know
+	 */
+	static double TimeOnAirMs(const ModulationParams_t &modparams, const PacketParams_t &pktparams);
+
+	/*!
+	 * \brief The current packet parameters with the payload length of the active packet type replaced
+	 */
+	PacketParams_t WithPayloadLength(uint8_t payloadLength);
 };
 
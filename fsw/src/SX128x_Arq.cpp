@@ -0,0 +1,565 @@
+/*
+    This file is part of SX128x Linux driver.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "SX128x_Arq.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+using namespace std::chrono;
+
+// Frame flags
+static constexpr uint8_t FLAG_DATA = 0x01;
+
+SX128x_Arq::SX128x_Arq(SX128x_Arq::Emit emit, SX128x_Arq::AirTime airtime) :
+	SX128x_Arq(Config(), std::move(emit), std::move(airtime)) {
+}
+
+SX128x_Arq::SX128x_Arq(const SX128x_Arq::Config &config, SX128x_Arq::Emit emit, SX128x_Arq::AirTime airtime) :
+	Cfg(config), DoEmit(std::move(emit)), DoAirTime(std::move(airtime)) {
+	if (Cfg.frame_size <= HeaderSize)
+		throw std::invalid_argument("frame too small");
+
+	if (!Cfg.window || Cfg.window > MaxWindow)
+		throw std::invalid_argument("window out of range");
+
+	if (!Cfg.max_peers || Cfg.max_peers == NoPeer)
+		throw std::invalid_argument("max_peers out of range");
+
+	if (Cfg.tick <= milliseconds::zero())
+		throw std::invalid_argument("tick must be positive");
+
+	if (!DoEmit || !DoAirTime)
+		throw std::invalid_argument("emit and airtime are required");
+
+	Payload = Cfg.frame_size - HeaderSize;
+
+	// Sequences are 8 bit, MaxWindow slots keep seq % MaxWindow unique across the wrap
+	size_t slots = (size_t)MaxWindow * Cfg.max_peers;
+
+	Peers = std::make_unique<Peer[]>(Cfg.max_peers);
+	TxSlots = std::make_unique<TxSlot[]>(slots);
+	RxSlots = std::make_unique<RxSlot[]>(slots);
+	Buffers = std::make_unique<uint8_t[]>(slots * 2 * Payload);
+	Staging = std::make_unique<uint8_t[]>(2 * MaxWindow * Payload);
+
+	for (size_t i = 0; i < slots; i++) {
+		TxSlots[i].data = &Buffers[i * Payload];
+		RxSlots[i].data = &Buffers[(slots + i) * Payload];
+	}
+
+	for (uint8_t i = 0; i < Cfg.max_peers; i++) {
+		Peer &p = Peers[i];
+
+		p.tx = &TxSlots[(size_t)MaxWindow * i];
+		p.rx = &RxSlots[(size_t)MaxWindow * i];
+		p.ack_timer.kind = TIMER_ACK;
+		p.ack_timer.peer = i;
+
+		for (uint8_t j = 0; j < MaxWindow; j++) {
+			p.tx[j].timer.peer = i;
+			p.tx[j].timer.slot = j;
+		}
+	}
+
+	memset(PeerIndex, NoPeer, sizeof(PeerIndex));
+}
+
+SX128x_Arq::Emit SX128x_Arq::StreamEmit(SX128x &radio) {
+	return [&radio](const uint8_t *frame, uint8_t size) {
+		// Blocking here would stall the Rx path behind our lock, a refused frame goes next tick
+		return radio.QueueTx(frame, size);
+	};
+}
+
+SX128x_Arq::AirTime SX128x_Arq::AirTimeOf(SX128x &radio) {
+	return [&radio](uint8_t size) {
+		return microseconds(radio.GetTimeOnAirUs(size));
+	};
+}
+
+void SX128x_Arq::SetDeliverHandler(SX128x_Arq::DeliverHandler handler) {
+	std::lock_guard<std::mutex> lg(Lock);
+	OnDeliver = std::move(handler);
+}
+
+SX128x_Arq::Peer *SX128x_Arq::FindPeer(uint8_t address, bool create) {
+	if (PeerIndex[address] != NoPeer)
+		return &Peers[PeerIndex[address]];
+
+	if (!create)
+		return nullptr;
+
+	for (uint8_t i = 0; i < Cfg.max_peers; i++) {
+		Peer &p = Peers[i];
+
+		if (p.used)
+			continue;
+
+		p.used = true;
+		p.address = address;
+		p.tx_base = p.tx_next = p.rx_next = 0;
+		p.ack_pending = false;
+		p.rtt_valid = false;
+		p.backoff = 0;
+		PeerIndex[address] = i;
+
+		return &p;
+	}
+
+	return nullptr;
+}
+
+uint64_t SX128x_Arq::ToTick(Clock::time_point t) const {
+	return duration_cast<nanoseconds>(t.time_since_epoch()).count() / duration_cast<nanoseconds>(Cfg.tick).count();
+}
+
+void SX128x_Arq::Arm(SX128x_Arq::Timer &timer, Clock::time_point now, microseconds delay) {
+	Disarm(timer);
+
+	// Rounded up, a timer never fires early
+	uint64_t expires = ToTick(now + delay + Cfg.tick - nanoseconds(1));
+	if (expires <= WheelTick)
+		expires = WheelTick + 1;
+
+	Timer *&head = Wheel[expires % WheelSlots];
+
+	timer.expires = expires;
+	timer.prev = nullptr;
+	timer.next = head;
+	if (head)
+		head->prev = &timer;
+	head = &timer;
+	timer.armed = true;
+}
+
+void SX128x_Arq::Disarm(SX128x_Arq::Timer &timer) {
+	if (!timer.armed)
+		return;
+
+	if (timer.prev)
+		timer.prev->next = timer.next;
+	else
+		Wheel[timer.expires % WheelSlots] = timer.next;
+
+	if (timer.next)
+		timer.next->prev = timer.prev;
+
+	timer.prev = timer.next = nullptr;
+	timer.armed = false;
+}
+
+void SX128x_Arq::Tick(Clock::time_point now) {
+	std::lock_guard<std::mutex> lg(Lock);
+
+	uint64_t target = ToTick(now);
+	if (target <= WheelTick)
+		return;
+
+	// A full turn visits every slot, no need to go around again after a long stall
+	uint64_t steps = std::min<uint64_t>(target - WheelTick, WheelSlots);
+
+	for (uint64_t i = 1; i <= steps; i++) {
+		Timer **head = &Wheel[(WheelTick + i) % WheelSlots];
+
+		// Firing may arm or disarm others in this slot, so rescan from the head each time
+		for (;;) {
+			Timer *t = *head;
+			while (t && t->expires > target)
+				t = t->next;
+
+			if (!t)
+				break;
+
+			Disarm(*t);
+			Fire(*t, now);
+		}
+	}
+
+	WheelTick = target;
+}
+
+void SX128x_Arq::Fire(SX128x_Arq::Timer &timer, Clock::time_point now) {
+	Peer &p = Peers[timer.peer];
+
+	if (timer.kind == TIMER_ACK) {
+		if (p.ack_pending)
+			SendAck(p, now);
+		return;
+	}
+
+	TxSlot &s = p.tx[timer.slot];
+
+	if (!s.pending) {
+		if (s.retries >= Cfg.max_retries) {
+			// Give up, the next frames carry the new base and the receiver skips it
+			s.acked = true;
+			Counters.dropped++;
+			Slide(p);
+			return;
+		}
+
+		s.retries++;
+		p.backoff = std::max(p.backoff, s.retries);
+		Counters.retransmitted++;
+	}
+
+	Transmit(p, s, now);
+}
+
+void SX128x_Arq::WriteHeader(SX128x_Arq::Peer &peer, uint8_t *frame, bool data) {
+	uint16_t bitmap = 0;
+
+	for (uint8_t i = 0; i < 16; i++) {
+		uint8_t seq = peer.rx_next + 1 + i;
+		RxSlot &r = peer.rx[seq % MaxWindow];
+
+		if (i + 1 < Cfg.window && r.have && r.seq == seq)
+			bitmap |= 1 << i;
+	}
+
+	frame[0] = data ? FLAG_DATA : 0;
+	frame[1] = Cfg.address;
+	frame[2] = peer.address;
+	frame[3] = 0;
+	frame[4] = peer.tx_base;
+	frame[5] = peer.rx_next;
+	frame[6] = bitmap & 0xFF;
+	frame[7] = bitmap >> 8;
+}
+
+microseconds SX128x_Arq::BaseRto(const SX128x_Arq::Peer &peer) const {
+	if (!peer.rtt_valid)
+		return Cfg.initial_rtt;
+
+	return peer.srtt + std::max<microseconds>(Cfg.tick, 4 * peer.rttvar);
+}
+
+microseconds SX128x_Arq::GetRto(uint8_t peer) {
+	std::lock_guard<std::mutex> lg(Lock);
+
+	Peer *p = FindPeer(peer, false);
+	return p ? BaseRto(*p) : microseconds(Cfg.initial_rtt);
+}
+
+void SX128x_Arq::Transmit(SX128x_Arq::Peer &peer, SX128x_Arq::TxSlot &slot, Clock::time_point now) {
+	uint8_t frame[255];
+
+	// Header written at each try, so a retransmission carries the latest acknowledgement
+	WriteHeader(peer, frame, true);
+	frame[3] = slot.seq;
+	memcpy(frame + HeaderSize, slot.data, slot.size);
+
+	// Armed first, so a frame whose emit throws is still retried
+	slot.pending = true;
+	Arm(slot.timer, now, Cfg.tick);
+
+	if (!DoEmit(frame, HeaderSize + slot.size))
+		return;
+
+	slot.pending = false;
+	slot.sent = now;
+
+	if (peer.ack_pending) {
+		peer.ack_pending = false;
+		Disarm(peer.ack_timer);
+	}
+
+	// Exponential backoff on the round trip part, the air time is what it is.
+	// New frames keep the peer's backoff, Karn's rule gets no sample otherwise.
+	uint8_t shift = std::min<uint8_t>(std::max(slot.retries, peer.backoff), 6);
+	microseconds rto = BaseRto(peer) * (1 << shift) + DoAirTime(HeaderSize + slot.size);
+	rto = std::min<microseconds>(std::max<microseconds>(rto, Cfg.min_rto), Cfg.max_rto);
+
+	Arm(slot.timer, now, rto);
+}
+
+void SX128x_Arq::SendAck(SX128x_Arq::Peer &peer, Clock::time_point now) {
+	uint8_t frame[HeaderSize];
+
+	WriteHeader(peer, frame, false);
+
+	peer.ack_pending = true;
+	Arm(peer.ack_timer, now, Cfg.tick);
+
+	if (!DoEmit(frame, HeaderSize))
+		return;
+
+	peer.ack_pending = false;
+	Disarm(peer.ack_timer);
+	Counters.acks_sent++;
+}
+
+bool SX128x_Arq::Send(uint8_t peer, const uint8_t *payload, uint8_t size, Clock::time_point now) {
+	if (size > Payload)
+		throw std::length_error("payload larger than frame_size - HeaderSize");
+
+	std::lock_guard<std::mutex> lg(Lock);
+
+	Peer *p = FindPeer(peer, true);
+	if (!p)
+		return false;
+
+	if ((uint8_t)(p->tx_next - p->tx_base) >= Cfg.window)
+		return false;
+
+	TxSlot &s = p->tx[p->tx_next % MaxWindow];
+
+	s.seq = p->tx_next++;
+	s.size = size;
+	s.retries = 0;
+	s.acked = false;
+	s.pending = false;
+	memcpy(s.data, payload, size);
+
+	try {
+		Transmit(*p, s, now);
+	} catch (...) {
+		// Still the newest, under the lock
+		Disarm(s.timer);
+		p->tx_next--;
+		throw;
+	}
+
+	Counters.sent++;
+
+	return true;
+}
+
+void SX128x_Arq::Slide(SX128x_Arq::Peer &peer) {
+	while (peer.tx_base != peer.tx_next && peer.tx[peer.tx_base % MaxWindow].acked)
+		peer.tx_base++;
+}
+
+void SX128x_Arq::OnAck(SX128x_Arq::Peer &peer, uint8_t ack, uint16_t bitmap, Clock::time_point now) {
+	uint8_t inflight = peer.tx_next - peer.tx_base;
+	uint8_t cumulative = ack - peer.tx_base;
+
+	// Behind our base (stale, or we gave up on what it's waiting for) or beyond what we sent
+	if (cumulative > inflight)
+		return;
+
+	bool sampled = false, hits = false;
+	Clock::time_point oldest, newest;
+	uint8_t newest_i = 0;
+	microseconds sample{0};
+
+	for (uint8_t i = 0; i < inflight; i++) {
+		TxSlot &s = peer.tx[(uint8_t)(peer.tx_base + i) % MaxWindow];
+
+		if (s.acked)
+			continue;
+
+		bool hit = i < cumulative;
+		if (!hit && i > cumulative) {
+			uint8_t bit = i - cumulative - 1;
+			hit = bit < 16 && (bitmap >> bit) & 1;
+		}
+
+		if (!hit)
+			continue;
+
+		s.acked = true;
+		Disarm(s.timer);
+
+		if (!hits || s.sent >= newest) {
+			hits = true;
+			newest = s.sent;
+			newest_i = i;
+		}
+
+		// Karn: a retransmitted frame can't tell which copy got acknowledged.
+		// The oldest one waited the whole ack_delay, so it's the one to time.
+		if (!s.retries && !s.pending && (!sampled || s.sent < oldest)) {
+			sampled = true;
+			oldest = s.sent;
+			sample = duration_cast<microseconds>(now - s.sent) - DoAirTime(HeaderSize + s.size);
+		}
+	}
+
+	if (sampled) {
+		sample = std::max(sample, microseconds::zero());
+		peer.backoff = 0;
+
+		if (!peer.rtt_valid) {
+			peer.srtt = sample;
+			peer.rttvar = sample / 2;
+			peer.rtt_valid = true;
+		} else {
+			peer.rttvar = (3 * peer.rttvar + (peer.srtt > sample ? peer.srtt - sample : sample - peer.srtt)) / 4;
+			peer.srtt = (7 * peer.srtt + sample) / 8;
+		}
+	}
+
+	// A frame sent after a hole made it, and the hole had a round trip to: it's lost
+	for (uint8_t i = 0; hits && peer.rtt_valid && i < inflight; i++) {
+		TxSlot &s = peer.tx[(uint8_t)(peer.tx_base + i) % MaxWindow];
+
+		if (s.acked || s.pending || s.retries >= Cfg.max_retries)
+			continue;
+
+		if ((s.sent < newest || (s.sent == newest && i < newest_i)) && now - s.sent >= peer.srtt) {
+			s.retries++;
+			Counters.retransmitted++;
+			Transmit(peer, s, now);
+		}
+	}
+
+	Slide(peer);
+}
+
+bool SX128x_Arq::OnFrame(const uint8_t *frame, uint8_t size, Clock::time_point now) {
+	if (size < HeaderSize) {
+		std::lock_guard<std::mutex> lg(Lock);
+		Counters.malformed++;
+		return false;
+	}
+
+	uint8_t flags = frame[0], src = frame[1], dst = frame[2];
+	uint8_t seq = frame[3], base = frame[4], ack = frame[5];
+	uint16_t bitmap = frame[6] | (frame[7] << 8);
+	uint8_t len = size - HeaderSize;
+	bool data = flags & FLAG_DATA;
+
+	if (dst != Cfg.address || src == Cfg.address)
+		return false;
+
+	std::unique_lock<std::mutex> lk(Lock);
+
+	if ((flags & ~FLAG_DATA) || (data ? len > Payload : len != 0)) {
+		Counters.malformed++;
+		return false;
+	}
+
+	Peer *p = FindPeer(src, true);
+	if (!p) {
+		Counters.refused++;
+		return false;
+	}
+
+	OnAck(*p, ack, bitmap, now);
+
+	if (!data)
+		return true;
+
+	// Copied out, so the handler runs unlocked and may Send() right away
+	uint8_t sizes[2 * MaxWindow];
+	uint8_t ready = 0;
+
+	auto take = [&](RxSlot& r) {
+		memcpy(&Staging[(size_t)ready * Payload], r.data, r.size);
+		sizes[ready++] = r.size;
+		r.have = false;
+	};
+
+	// The sender gave up on what's before base, hand over what we have of it
+	uint8_t skip = base - p->rx_next;
+	if (skip && skip < 128) {
+		for (uint8_t i = 0; i < std::min<uint8_t>(skip, MaxWindow); i++) {
+			uint8_t s = p->rx_next + i;
+			RxSlot &r = p->rx[s % MaxWindow];
+
+			if (r.have && r.seq == s)
+				take(r);
+		}
+
+		p->rx_next = base;
+
+		for (uint8_t i = 0; i < MaxWindow; i++) {
+			if ((uint8_t)(p->rx[i].seq - base) >= Cfg.window)
+				p->rx[i].have = false;
+		}
+	}
+
+	uint8_t offset = seq - p->rx_next;
+	RxSlot &r = p->rx[seq % MaxWindow];
+
+	if (offset >= Cfg.window || (r.have && r.seq == seq)) {
+		// Our acknowledgement got lost, repeat it now
+		Counters.duplicates++;
+		SendAck(*p, now);
+		return false;
+	}
+
+	r.seq = seq;
+	r.size = len;
+	r.have = true;
+	memcpy(r.data, frame + HeaderSize, len);
+
+	for (;;) {
+		RxSlot &n = p->rx[p->rx_next % MaxWindow];
+		if (!n.have || n.seq != p->rx_next)
+			break;
+
+		take(n);
+		p->rx_next++;
+	}
+
+	if (offset) {
+		// A gap, let the sender know without waiting
+		SendAck(*p, now);
+	} else if (!p->ack_pending) {
+		p->ack_pending = true;
+		Arm(p->ack_timer, now, Cfg.ack_delay);
+	}
+
+	Counters.delivered += ready;
+	lk.unlock();
+
+	if (OnDeliver) {
+		for (uint8_t i = 0; i < ready; i++)
+			OnDeliver(src, &Staging[(size_t)i * Payload], sizes[i]);
+	}
+
+	return true;
+}
+
+void SX128x_Arq::Reset(uint8_t peer) {
+	std::lock_guard<std::mutex> lg(Lock);
+
+	Peer *p = FindPeer(peer, false);
+	if (!p)
+		return;
+
+	for (uint8_t i = 0; i < MaxWindow; i++) {
+		Disarm(p->tx[i].timer);
+		p->rx[i].have = false;
+	}
+
+	for (uint8_t s = p->tx_base; s != p->tx_next; s++) {
+		if (!p->tx[s % MaxWindow].acked)
+			Counters.dropped++;
+	}
+
+	Disarm(p->ack_timer);
+	p->used = false;
+	PeerIndex[peer] = NoPeer;
+}
+
+uint8_t SX128x_Arq::InFlight(uint8_t peer) {
+	std::lock_guard<std::mutex> lg(Lock);
+
+	Peer *p = FindPeer(peer, false);
+	return p ? p->tx_next - p->tx_base : 0;
+}
+
+SX128x_Arq::Stats SX128x_Arq::GetStats() {
+	std::lock_guard<std::mutex> lg(Lock);
+	return Counters;
+}
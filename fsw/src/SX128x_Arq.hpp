@@ -0,0 +1,204 @@
+/*
+    This file is part of SX128x Linux driver.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <SX128x.hpp>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <functional>
+
+#include <cinttypes>
+
+// Selective repeat ARQ between this node and up to max_peers others.
+// Every frame starts with an 8 byte header: flags, source, destination, sequence,
+// the sender's oldest unacknowledged sequence, the next sequence expected from the
+// destination and a 16 bit bitmap of the ones received after it. Acknowledgements
+// ride on data frames, a bare one is sent after ack_delay when there's no traffic back.
+// Retransmit timeouts follow the measured round trip (RFC 6298, Karn's rule) plus the
+// air time of the frame. All the timers sit in one wheel, driven by Tick().
+// Both ends start at sequence 0, call Reset() on a peer that restarted.
+class SX128x_Arq {
+public:
+	static constexpr uint8_t HeaderSize = 8;
+	static constexpr uint8_t MaxWindow = 16;
+	static constexpr uint8_t NoPeer = 0xFF;
+
+	typedef std::chrono::steady_clock Clock;
+
+	struct Config {
+		uint8_t address = 0;
+		uint8_t frame_size = 127;		// Header included, both ends must agree
+		uint8_t window = 8;			// Frames in flight per peer, up to MaxWindow
+		uint8_t max_peers = 8;
+		uint8_t max_retries = 8;		// Then the frame is dropped and the window moves on
+		std::chrono::milliseconds initial_rtt{500};	// Until the first sample
+		std::chrono::milliseconds min_rto{50};
+		std::chrono::milliseconds max_rto{10000};
+		std::chrono::milliseconds ack_delay{20};	// Wait for data to piggyback on
+		std::chrono::milliseconds tick{5};		// Timer resolution
+	};
+
+	struct Stats {
+		uint32_t sent = 0;
+		uint32_t retransmitted = 0;
+		uint32_t delivered = 0;
+		uint32_t dropped = 0;		// Given up after max_retries
+		uint32_t duplicates = 0;
+		uint32_t malformed = 0;
+		uint32_t refused = 0;		// Frames from a peer that didn't fit the table
+		uint32_t acks_sent = 0;		// Bare acknowledgements only
+	};
+
+	// Puts a frame on air, false when it can't take one now (it's retried next tick).
+	// Called with the engine locked, it must not call back into it. When it throws,
+	// the frame is retried like a refused one and the exception reaches the caller,
+	// except for Send(), which takes its frame back first.
+	typedef std::function<bool(const uint8_t *frame, uint8_t size)> Emit;
+
+	// Air time of a frame of the given size, see AirTimeOf()
+	typedef std::function<std::chrono::microseconds(uint8_t size)> AirTime;
+
+	// Called in order with each payload received from peer, valid until the handler returns
+	typedef std::function<void(uint8_t peer, const uint8_t *payload, uint8_t size)> DeliverHandler;
+
+	SX128x_Arq(Emit emit, AirTime airtime);
+
+	SX128x_Arq(const Config& config, Emit emit, AirTime airtime);
+
+	// Emits over a Tx stream started with SX128x::StartTxStream(), never waits for room in it.
+	// The radio is half duplex: start the stream with an idle Rx timeout, so it listens
+	// for the acknowledgements whenever the stream runs dry. Re-arming Rx from the
+	// application instead would abort a frame the stream just started.
+	static Emit StreamEmit(SX128x& radio);
+
+	// Air time from the radio's current modulation and packet parameters
+	static AirTime AirTimeOf(SX128x& radio);
+
+	void SetDeliverHandler(DeliverHandler handler);
+
+	// Sends payload to peer, false when its window or the peer table is full.
+	// Throws std::length_error above frame_size - HeaderSize, and what Emit throws,
+	// in which case nothing was queued.
+	bool Send(uint8_t peer, const uint8_t *payload, uint8_t size, Clock::time_point now = Clock::now());
+
+	// Feeds a received frame, returns false when it was malformed, not for us or a duplicate.
+	// Payloads are delivered before it returns, feed it from one thread.
+	bool OnFrame(const uint8_t *frame, uint8_t size, Clock::time_point now = Clock::now());
+
+	// Runs the due retransmissions and acknowledgements, every tick from one thread
+	// (e.g. a GPIO::Device timer)
+	void Tick(Clock::time_point now = Clock::now());
+
+	// Forgets everything about peer, dropping what's in flight
+	void Reset(uint8_t peer);
+
+	uint8_t InFlight(uint8_t peer);
+
+	// Current retransmit timeout of peer without the air time and backoff
+	std::chrono::microseconds GetRto(uint8_t peer);
+
+	Stats GetStats();
+
+private:
+	enum TimerKind : uint8_t {
+		TIMER_RETRANSMIT, TIMER_ACK
+	};
+
+	struct Timer {
+		Timer *prev = nullptr, *next = nullptr;
+		uint64_t expires = 0;
+		bool armed = false;
+		TimerKind kind = TIMER_RETRANSMIT;
+		uint8_t peer = 0, slot = 0;
+	};
+
+	struct TxSlot {
+		uint8_t seq = 0, size = 0, retries = 0;
+		bool acked = false;
+		bool pending = false;		// Emit refused it, not on air yet
+		Clock::time_point sent;
+		Timer timer;
+		uint8_t *data = nullptr;
+	};
+
+	struct RxSlot {
+		uint8_t seq = 0, size = 0;
+		bool have = false;
+		uint8_t *data = nullptr;
+	};
+
+	struct Peer {
+		uint8_t address = 0;
+		bool used = false;
+		uint8_t tx_base = 0, tx_next = 0;
+		uint8_t rx_next = 0;
+		bool ack_pending = false;
+		bool rtt_valid = false;
+		uint8_t backoff = 0;		// Kept from the last timeout until a new sample
+		std::chrono::microseconds srtt{0}, rttvar{0};
+		Timer ack_timer;
+		TxSlot *tx = nullptr;
+		RxSlot *rx = nullptr;
+	};
+
+	Config Cfg;
+	uint8_t Payload;
+	Emit DoEmit;
+	AirTime DoAirTime;
+	DeliverHandler OnDeliver;
+
+	std::mutex Lock;
+	Stats Counters;
+
+	// One allocation each for all the peers, made up front
+	std::unique_ptr<Peer[]> Peers;
+	std::unique_ptr<TxSlot[]> TxSlots;
+	std::unique_ptr<RxSlot[]> RxSlots;
+	std::unique_ptr<uint8_t[]> Buffers;
+	std::unique_ptr<uint8_t[]> Staging;	// Payloads on their way to the handler
+	uint8_t PeerIndex[256];
+
+	// Hashed wheel of intrusive lists, a timer sits in slot expires % WheelSlots
+	static constexpr uint16_t WheelSlots = 512;
+	Timer *Wheel[WheelSlots] = {};
+	uint64_t WheelTick = 0;
+
+	Peer *FindPeer(uint8_t address, bool create);
+
+	uint64_t ToTick(Clock::time_point t) const;
+
+	void Arm(Timer& timer, Clock::time_point now, std::chrono::microseconds delay);
+
+	void Disarm(Timer& timer);
+
+	void Fire(Timer& timer, Clock::time_point now);
+
+	void WriteHeader(Peer& peer, uint8_t *frame, bool data);
+
+	void Transmit(Peer& peer, TxSlot& slot, Clock::time_point now);
+
+	void SendAck(Peer& peer, Clock::time_point now);
+
+	std::chrono::microseconds BaseRto(const Peer& peer) const;
+
+	void OnAck(Peer& peer, uint8_t ack, uint16_t bitmap, Clock::time_point now);
+
+	void Slide(Peer& peer);
+};
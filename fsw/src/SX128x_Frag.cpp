@@ -0,0 +1,194 @@
+/*
+    This file is part of SX128x Linux driver.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "SX128x_Frag.hpp"
+
+#include <thread>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+SX128x_Frag::SX128x_Frag() : SX128x_Frag(Config()) {
+}
+
+SX128x_Frag::SX128x_Frag(const SX128x_Frag::Config &config) : Cfg(config) {
+	if (Cfg.frame_size <= HeaderSize || !Cfg.slots)
+		throw std::invalid_argument("frame too small or no reassembly slot");
+
+	Chunk = Cfg.frame_size - HeaderSize;
+
+	size_t fragments = (Cfg.max_message + Chunk - 1) / Chunk;
+	if (fragments > MaxFragments)
+		throw std::invalid_argument("max_message needs too many fragments");
+
+	MaxCount = std::max<size_t>(fragments, 1);
+	BitmapWords = (MaxCount + 63) / 64;
+
+	Slots = std::make_unique<Slot[]>(Cfg.slots);
+	Bitmaps = std::make_unique<uint64_t[]>((size_t)BitmapWords * Cfg.slots);
+	Buffers = std::make_unique<uint8_t[]>(Cfg.max_message * Cfg.slots);
+
+	for (uint8_t i = 0; i < Cfg.slots; i++) {
+		Slots[i].bitmap = &Bitmaps[(size_t)BitmapWords * i];
+		Slots[i].data = &Buffers[Cfg.max_message * i];
+	}
+}
+
+uint8_t SX128x_Frag::Fragment(const uint8_t *msg, size_t len, const std::function<bool(const uint8_t *, uint8_t)> &emit) {
+	if (len > Cfg.max_message)
+		throw std::length_error("message larger than max_message");
+
+	uint8_t id = NextId++;
+	uint16_t count = std::max<size_t>((len + Chunk - 1) / Chunk, 1);
+	uint8_t frame[255];
+
+	for (uint16_t i = 0; i < count; i++) {
+		size_t off = (size_t)i * Chunk;
+		uint8_t size = std::min<size_t>(Chunk, len - off);
+
+		frame[0] = id;
+		frame[1] = ((i >> 8) << 4) | (count >> 8);
+		frame[2] = i & 0xFF;
+		frame[3] = count & 0xFF;
+		if (size)
+			memcpy(frame + HeaderSize, msg + off, size);
+
+		if (!emit(frame, HeaderSize + size))
+			break;
+	}
+
+	return id;
+}
+
+uint8_t SX128x_Frag::Send(SX128x &radio, const uint8_t *msg, size_t len) {
+	return Fragment(msg, len, [&radio](const uint8_t *frame, uint8_t size) {
+		// The stream takes the next frame as soon as the previous one is on air
+		while (!radio.QueueTx(frame, size))
+			std::this_thread::yield();
+
+		return true;
+	});
+}
+
+void SX128x_Frag::Release(Slot &slot) {
+	slot.used = false;
+	std::fill(slot.bitmap, slot.bitmap + BitmapWords, 0);
+}
+
+void SX128x_Frag::Expire(Clock::time_point now) {
+	for (uint8_t i = 0; i < Cfg.slots; i++) {
+		if (Slots[i].used && now - Slots[i].last > Cfg.timeout) {
+			Release(Slots[i]);
+			Counters.timeouts++;
+		}
+	}
+}
+
+SX128x_Frag::Slot *SX128x_Frag::FindSlot(uint8_t id, uint16_t count, Clock::time_point now) {
+	Slot *vacant = nullptr, *oldest = nullptr;
+
+	for (uint8_t i = 0; i < Cfg.slots; i++) {
+		Slot &s = Slots[i];
+
+		if (!s.used) {
+			if (!vacant)
+				vacant = &s;
+			continue;
+		}
+
+		if (s.id == id) {
+			if (s.count == count)
+				return &s;
+
+			// Same id reused for another message, the old one won't complete
+			Release(s);
+			Counters.evicted++;
+			if (!vacant)
+				vacant = &s;
+			continue;
+		}
+
+		if (!oldest || s.last < oldest->last)
+			oldest = &s;
+	}
+
+	if (!vacant) {
+		Release(*oldest);
+		Counters.evicted++;
+		vacant = oldest;
+	}
+
+	vacant->used = true;
+	vacant->id = id;
+	vacant->count = count;
+	vacant->received = 0;
+	vacant->length = 0;
+	vacant->last = now;
+
+	return vacant;
+}
+
+bool SX128x_Frag::OnFrame(const uint8_t *frame, uint8_t size, Clock::time_point now) {
+	Expire(now);
+
+	if (size < HeaderSize) {
+		Counters.malformed++;
+		return false;
+	}
+
+	uint8_t id = frame[0];
+	uint16_t index = ((frame[1] >> 4) << 8) | frame[2];
+	uint16_t count = ((frame[1] & 0x0F) << 8) | frame[3];
+	uint8_t chunk = size - HeaderSize;
+	size_t off = (size_t)index * Chunk;
+
+	// Only the last fragment may be short, and empty only when it's the only one.
+	// count is capped too, the bitmap of a slot has MaxCount bits.
+	if (!count || count > MaxCount || index >= count || (index + 1 < count && chunk != Chunk) || chunk > Chunk ||
+	    (!chunk && count != 1) || off + chunk > Cfg.max_message) {
+		Counters.malformed++;
+		return false;
+	}
+
+	Slot *slot = FindSlot(id, count, now);
+	uint64_t bit = 1ULL << (index % 64);
+
+	if (slot->bitmap[index / 64] & bit) {
+		Counters.duplicates++;
+		return false;
+	}
+
+	slot->bitmap[index / 64] |= bit;
+	slot->received++;
+	slot->last = now;
+	memcpy(slot->data + off, frame + HeaderSize, chunk);
+
+	if (index + 1 == count)
+		slot->length = off + chunk;
+
+	if (slot->received < slot->count)
+		return false;
+
+	Counters.completed++;
+	if (OnMessage)
+		OnMessage(id, slot->data, slot->length);
+
+	Release(*slot);
+
+	return true;
+}
@@ -0,0 +1,111 @@
+/*
+    This file is part of SX128x Linux driver.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <SX128x.hpp>
+
+#include <chrono>
+#include <memory>
+#include <functional>
+
+#include <cinttypes>
+
+// Splits messages larger than a radio frame into fragments and reassembles them.
+// Every frame starts with a 4 byte header: message id, then the fragment index and
+// the fragment count in 12 bits each. All fragments but the last fill the frame.
+// Not thread safe, feed OnFrame() from one thread.
+class SX128x_Frag {
+public:
+	static constexpr uint8_t HeaderSize = 4;
+	static constexpr uint16_t MaxFragments = 4095;
+
+	typedef std::chrono::steady_clock Clock;
+
+	struct Config {
+		uint8_t frame_size = 127;		// Header included, both ends must agree
+		uint8_t slots = 4;			// Messages reassembled at once
+		size_t max_message = 8192;		// Longer messages are refused by Fragment() and dropped by OnFrame()
+		std::chrono::milliseconds timeout{2000};	// Since the last fragment of a message
+	};
+
+	struct Stats {
+		uint32_t completed = 0;
+		uint32_t timeouts = 0;		// Incomplete messages dropped after the timeout
+		uint32_t evicted = 0;		// Incomplete messages dropped for a slot
+		uint32_t duplicates = 0;
+		uint32_t malformed = 0;
+	};
+
+	// Called with the reassembled message, valid until the handler returns
+	typedef std::function<void(uint8_t id, const uint8_t *msg, size_t len)> MessageHandler;
+
+	SX128x_Frag();
+
+	explicit SX128x_Frag(const Config& config);
+
+	void SetMessageHandler(MessageHandler handler) {
+		OnMessage = std::move(handler);
+	}
+
+	// Calls emit with each frame of msg in order, stops early when emit returns false.
+	// Returns the message id. Throws std::length_error above max_message.
+	uint8_t Fragment(const uint8_t *msg, size_t len, const std::function<bool(const uint8_t *frame, uint8_t size)>& emit);
+
+	// Sends msg over a Tx stream started with SX128x::StartTxStream(), waiting for room in it.
+	// frame_size must not exceed SX128x::TX_STREAM_MAX_SIZE.
+	uint8_t Send(SX128x& radio, const uint8_t *msg, size_t len);
+
+	// Feeds a received frame, returns true when it completed a message
+	bool OnFrame(const uint8_t *frame, uint8_t size, Clock::time_point now = Clock::now());
+
+	// Drops the messages without a fragment for the timeout, OnFrame() does it too
+	void Expire(Clock::time_point now = Clock::now());
+
+	const Stats& GetStats() const {
+		return Counters;
+	}
+
+private:
+	struct Slot {
+		bool used = false;
+		uint8_t id = 0;
+		uint16_t count = 0, received = 0;
+		size_t length = 0;
+		Clock::time_point last;
+		uint64_t *bitmap = nullptr;
+		uint8_t *data = nullptr;
+	};
+
+	Config Cfg;
+	uint8_t Chunk;
+	uint16_t MaxCount;		// Fragments of a max_message long message
+	uint16_t BitmapWords;
+	uint8_t NextId = 0;
+
+	// One allocation each for all the slots, made up front
+	std::unique_ptr<Slot[]> Slots;
+	std::unique_ptr<uint64_t[]> Bitmaps;
+	std::unique_ptr<uint8_t[]> Buffers;
+
+	MessageHandler OnMessage;
+	Stats Counters;
+
+	Slot *FindSlot(uint8_t id, uint16_t count, Clock::time_point now);
+
+	void Release(Slot& slot);
+};
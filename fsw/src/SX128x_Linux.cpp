@@ -18,71 +18,723 @@
 
 #include "SX128x_Linux.hpp"
 
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <alloca.h>
+
 SX128x_Linux::SX128x_Linux(const std::string &spi_dev_path, uint16_t gpio_dev_num, SX128x_Linux::PinConfig pin_config) :
 	pin_cfg(pin_config),
-	RadioSpi(spi_dev_path, SPI_MODE_0|SPI_NO_CS, 8, 500000),
+	RadioSpi(spi_dev_path, SPI_MODE_0|(UseGpioNss(pin_config) ? SPI_NO_CS : 0), 8, 500000),
 	RadioGpio(gpio_dev_num),
-	Busy(RadioGpio.line(pin_cfg.busy, GPIO::LineMode::Input, 0, "SX128x BUSY")),
-	RadioNss(RadioGpio.line(pin_cfg.nss, GPIO::LineMode::Output, 1, "SX128x NSS")),
 	RadioReset(RadioGpio.line(pin_cfg.nrst, GPIO::LineMode::Output, 1, "SX128x NRESET"))
 {
-	if (pin_config.tx_en >= 0) {
-		TxEn = RadioGpio.line(pin_cfg.tx_en, GPIO::LineMode::Output, 0, "SX128x TXEN");
+	if (pin_config.busy_events) {
+		try {
+			BusyEvent = RadioGpio.line_event(pin_cfg.busy, GPIO::LineMode::Input, GPIO::EventMode::FallingEdge, "SX128x BUSY");
+		} catch (std::system_error &) {
+			// No interrupt capable line, poll it
+		}
+	}
+
+	if (!BusyEvent) {
+		Busy = RadioGpio.line(pin_cfg.busy, GPIO::LineMode::Input, 0, "SX128x BUSY");
 	}
 
-	if (pin_config.rx_en >= 0) {
+	if (UseGpioNss(pin_config)) {
+		RadioNss = RadioGpio.line(pin_cfg.nss, GPIO::LineMode::Output, 1, "SX128x NSS");
+	} else {
+		// SPPI skips a zero mode, make sure a SPI_NO_CS left by a previous user is cleared
+		RadioSpi.set_mode(SPI_MODE_0);
+	}
+
+	if (pin_config.tx_en >= 0 && pin_config.rx_en >= 0) {
+		// One handle for both switch lines, HalSetRfPath() flips them in one ioctl
+		RfSwitch = RadioGpio.line({{(uint32_t)pin_cfg.tx_en, 0}, {(uint32_t)pin_cfg.rx_en, 0}}, GPIO::LineMode::Output,
+					  "SX128x RF switch");
+	} else if (pin_config.tx_en >= 0) {
+		TxEn = RadioGpio.line(pin_cfg.tx_en, GPIO::LineMode::Output, 0, "SX128x TXEN");
+	} else if (pin_config.rx_en >= 0) {
 		RxEn = RadioGpio.line(pin_cfg.rx_en, GPIO::LineMode::Output, 0, "SX128x RXEN");
 	}
 
+	// The DIO events below are requested with the default EventConfig
+	EventClock = GPIO::event_clock_id();
+
 	int i = 1;
 	for (auto it : {pin_config.dio1, pin_config.dio2, pin_config.dio3}) {
 		std::string label = "SX128x DIO";
 		label += std::to_string(i);
+		int line = i - 1;
 		i++;
 
 		if (it != -1) {
          //cfs error: ‘class YukiWorkshop::GPIO::Device’ has no member named ‘on_event’; did you mean ‘add_event’?
 			//cfs RadioGpio.on_event(it, GPIO::LineMode::Input, GPIO::EventMode::RisingEdge,
-         RadioGpio.add_event(it, GPIO::LineMode::Input, GPIO::EventMode::RisingEdge, //cfs
-					   [this](GPIO::EventType t, uint64_t) {
-						   if (t == GPIO::EventType::RisingEdge)
-							   ProcessIrqs();
+         int event_fd = RadioGpio.add_event(it, GPIO::LineMode::Input, GPIO::EventMode::RisingEdge, //cfs
+					   [this, line](GPIO::EventType t, uint64_t ts) {
+						   if (t != GPIO::EventType::RisingEdge)
+							   return;
+
+						   // Served from the line level by a poller since
+						   if (ts <= LastPolled[line].load(std::memory_order_acquire))
+							   return;
+
+						   if (PollRun.load(std::memory_order_acquire)) {
+							   OnPolledDioEdge(line, ts);
+							   return;
+						   }
+
+						   RecordIrqLatency(ts);
+
+						   if (ExecutorEnter()) {
+							   PendingEdge[line].store(ts, std::memory_order_relaxed);
+							   IrqPending.fetch_or(1 << line, std::memory_order_release);
+							   ExecutorWake();
+							   ExecutorLeave();
+						   } else {
+							   ServeDio(line, ts);
+						   }
 					   }, label);
+
+			DioLevel[line].emplace(dup(event_fd), it);
 		}
 	}
 }
 
+SX128x_Linux::~SX128x_Linux() {
+	// Their handlers capture this
+	try {
+		DetachIrqHandler();
+		StopPolling();
+		StopIrqHandler();
+		StopExecutor();
+	} catch (...) {
+	}
+}
+
 void SX128x_Linux::SetSpiSpeed(uint32_t hz) {
 	RadioSpi.set_max_speed_hz(hz);
 }
 
+SX128x_Linux::SpiBenchmark SX128x_Linux::BenchmarkChipSelect(uint32_t iterations) {
+	SpiBenchmark ret;
+	uint8_t buf_out[3] = {RADIO_GET_STATUS, 0, 0};
+	uint8_t buf_in[3];
+
+	if (!iterations)
+		return ret;
+
+	std::unique_lock<std::mutex> lg;
+
+	if (ExtLock)
+		lg = std::unique_lock<std::mutex>(*ExtLock);
+
+	// Both loops issue the very same transfer, so the difference is only the two GPIO writes.
+	// With a GPIO NSS the chip stays deselected in the first one. With ChipSelect::Hardware
+	// NRESET, already high, is written high instead: the same ioctl cost, no effect on the chip.
+	GPIO::LineSingle &framing = RadioNss ? *RadioNss : RadioReset;
+	uint8_t select = RadioNss ? 0 : 1;
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i=0; i<iterations; i++) {
+		RadioSpi.transfer(buf_out, buf_in, sizeof(buf_out), false);
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	ret.spi_only_ns = elapsed.count() / iterations;
+
+	start = std::chrono::steady_clock::now();
+	for (uint32_t i=0; i<iterations; i++) {
+		framing.write(select);
+		RadioSpi.transfer(buf_out, buf_in, sizeof(buf_out), false);
+		framing.write(1);
+	}
+	elapsed = std::chrono::steady_clock::now() - start;
+	ret.gpio_nss_ns = elapsed.count() / iterations;
+
+	return ret;
+}
+
 void SX128x_Linux::SetExternalLock(std::mutex &m) {
 	ExtLock = &m;
 }
 
 void SX128x_Linux::StartIrqHandler(int __prio) {
-	IrqThread = std::thread([this, __prio](){
-		sched_param param;
-		param.sched_priority = __prio;
-		pthread_setschedparam(pthread_self(), SCHED_RR, &param);
+	IrqThreadConfig config;
+	config.priority = __prio;
+
+	StartIrqHandler(config);
+}
+
+// Fault the stack in now rather than on the first interrupt. Not inlined, so the alloca()
+// is released on return and the caller's frames reuse the pages touched here.
+__attribute__((noinline)) static void PrefaultStack(size_t size) {
+	if (!size)
+		return;
+
+	volatile char *stack = (volatile char *)alloca(size);
+	for (size_t i = 0; i < size; i += 4096)
+		stack[i] = 0;
+}
+
+void SX128x_Linux::ConfiguredThread::start(const IrqThreadConfig &config, std::function<void()> fn) {
+	pthread_attr_t attr;
+	int rc = pthread_attr_init(&attr);
+
+	if (rc)
+		throw std::system_error(rc, std::system_category(), "failed to init thread attributes");
+
+	if (!config.cpus.empty()) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		for (auto it : config.cpus)
+			CPU_SET(it, &cpus);
+		rc = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+
+	sched_param param{};
+	param.sched_priority = config.policy == SCHED_OTHER ? 0 : config.priority;
+
+	if (!rc)
+		rc = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	if (!rc)
+		rc = pthread_attr_setschedpolicy(&attr, config.policy);
+	if (!rc)
+		rc = pthread_attr_setschedparam(&attr, &param);
+
+	prefault = config.stack_prefault;
+	body = std::move(fn);
+
+	// EPERM here without CAP_SYS_NICE for a realtime policy
+	if (!rc)
+		rc = pthread_create(&tid, &attr, &ConfiguredThread::entry, this);
+
+	pthread_attr_destroy(&attr);
+
+	if (rc) {
+		body = nullptr;
+		throw std::system_error(rc, std::system_category(), "failed to create thread with the given attributes");
+	}
+
+	started = true;
+}
+
+void SX128x_Linux::ConfiguredThread::join() {
+	if (!started)
+		return;
+
+	pthread_join(tid, nullptr);
+	started = false;
+	body = nullptr;
+}
+
+void *SX128x_Linux::ConfiguredThread::entry(void *arg) {
+	auto self = static_cast<ConfiguredThread *>(arg);
+
+	PrefaultStack(self->prefault);
+	self->body();
+
+	return nullptr;
+}
+
+uint64_t SX128x_Linux::EventClockNs() const {
+	timespec now;
+	clock_gettime(EventClock, &now);
+
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void SX128x_Linux::StartIrqHandler(const IrqThreadConfig &config) {
+	if (IrqThread.joinable())
+		throw std::logic_error("IRQ handler already running");
+
+	if (config.lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE))
+		throw ExceptionWithErrno("failed to lock memory");
+
+	IrqThread.start(config, [this](){
 		RadioGpio.run_eventlistener();
 	});
 }
 
 void SX128x_Linux::StopIrqHandler() {
+	if (!IrqThread.joinable())
+		return;
+
 	RadioGpio.stop_eventlistener();
 	IrqThread.join();
 }
 
+void SX128x_Linux::RecordIrqLatency(uint64_t timestamp) {
+	uint64_t now_ns = EventClockNs();
+
+	if (now_ns < timestamp)
+		return;
+
+	uint64_t lat = now_ns - timestamp;
+
+	// Only the IRQ thread writes, so min and max need no compare-exchange
+	IrqLatencyTotal.fetch_add(lat, std::memory_order_relaxed);
+	if (lat < IrqLatencyMin.load(std::memory_order_relaxed))
+		IrqLatencyMin.store(lat, std::memory_order_relaxed);
+	if (lat > IrqLatencyMax.load(std::memory_order_relaxed))
+		IrqLatencyMax.store(lat, std::memory_order_relaxed);
+	IrqEvents.fetch_add(1, std::memory_order_release);
+
+	IrqHistograms[(int)IrqLatencyStage::Wake].record(lat);
+}
+
+// The edge being served on this thread and its radio. Thread local, so ProcessIrqs() called
+// by an application thread meanwhile is neither racing on it nor credited to the edge.
+static thread_local struct {
+	const SX128x_Linux *radio = nullptr;
+	uint64_t timestamp = 0;
+} CurrentEdge;
+
+void SX128x_Linux::ServeDio(int line, uint64_t timestamp) {
+	// Restored on the way out, a callback may serve another radio on this thread
+	struct Restore {
+		decltype(CurrentEdge) saved = CurrentEdge;
+		~Restore() { CurrentEdge = saved; }
+	} restore;
+
+	CurrentEdge.radio = this;
+	CurrentEdge.timestamp = timestamp;
+	ProcessDioIrq(static_cast<GpioPinFunction_t>(GPIO_PIN_DIO1 + line));
+}
+
+void SX128x_Linux::HalIrqStage(IrqStage_t stage) {
+	if (CurrentEdge.radio != this || !CurrentEdge.timestamp)
+		return;
+
+	uint64_t now_ns = EventClockNs();
+	if (now_ns < CurrentEdge.timestamp)
+		return;
+
+	auto s = stage == IRQ_STAGE_STATUS_READ ? IrqLatencyStage::StatusRead : IrqLatencyStage::Callback;
+	IrqHistograms[(int)s].record(now_ns - CurrentEdge.timestamp);
+}
+
+int SX128x_Linux::LatencyHistogram::bucket(uint64_t ns) {
+	if (ns < (1 << SubBits))
+		return (int)ns;
+
+	int exp = 63 - __builtin_clzll(ns);
+	int sub = (int)(ns >> (exp - SubBits)) & ((1 << SubBits) - 1);
+
+	return std::min(((exp - SubBits + 1) << SubBits) + sub, Buckets - 1);
+}
+
+uint64_t SX128x_Linux::LatencyHistogram::bucket_limit(int i) {
+	if (i < (1 << SubBits))
+		return i;
+
+	int exp = (i >> SubBits) + SubBits - 1;
+	uint64_t sub = i & ((1 << SubBits) - 1);
+
+	return (((1ULL << SubBits) + sub + 1) << (exp - SubBits)) - 1;
+}
+
+void SX128x_Linux::LatencyHistogram::record(uint64_t ns) {
+	counts_[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+
+	uint64_t m = max_.load(std::memory_order_relaxed);
+	while (ns > m && !max_.compare_exchange_weak(m, ns, std::memory_order_relaxed))
+		;
+}
+
+uint64_t SX128x_Linux::LatencyHistogram::count() const {
+	uint64_t ret = 0;
+
+	for (auto &it : counts_)
+		ret += it.load(std::memory_order_relaxed);
+
+	return ret;
+}
+
+uint64_t SX128x_Linux::LatencyHistogram::percentile(double p) const {
+	uint64_t total = count();
+	if (!total)
+		return 0;
+
+	// Rank of the quantile, at least the first event
+	uint64_t rank = std::max<uint64_t>(1, (uint64_t)(p / 100.0 * total + 0.5));
+	uint64_t seen = 0;
+
+	for (int i = 0; i < Buckets; i++) {
+		seen += counts_[i].load(std::memory_order_relaxed);
+		if (seen >= rank)
+			return std::min(bucket_limit(i), max());
+	}
+
+	return max();
+}
+
+void SX128x_Linux::LatencyHistogram::reset() {
+	for (auto &it : counts_)
+		it.store(0, std::memory_order_relaxed);
+
+	max_.store(0, std::memory_order_relaxed);
+}
+
+SX128x_Linux::IrqLatencyStats SX128x_Linux::GetIrqLatencyStats() const {
+	IrqLatencyStats ret;
+
+	ret.events = IrqEvents.load(std::memory_order_acquire);
+	if (ret.events) {
+		ret.min_ns = IrqLatencyMin.load(std::memory_order_relaxed);
+		ret.max_ns = IrqLatencyMax.load(std::memory_order_relaxed);
+		ret.total_ns = IrqLatencyTotal.load(std::memory_order_relaxed);
+	}
+
+	return ret;
+}
+
+void SX128x_Linux::ResetIrqLatencyStats() {
+	IrqEvents = 0;
+	IrqLatencyMin = UINT64_MAX;
+	IrqLatencyMax = 0;
+	IrqLatencyTotal = 0;
+
+	for (auto &it : IrqHistograms)
+		it.reset();
+}
+
+void SX128x_Linux::AttachIrqHandler(GPIO::Reactor &reactor) {
+	if (IrqReactor)
+		throw std::logic_error("IRQ handler already attached");
+
+	reactor.add(RadioGpio);
+	IrqReactor = &reactor;
+}
+
+void SX128x_Linux::DetachIrqHandler() {
+	if (!IrqReactor)
+		return;
+
+	IrqReactor->remove(RadioGpio);
+	IrqReactor = nullptr;
+}
+
+void SX128x_Linux::StartPolling(const PollConfig &config) {
+	if (PollThread.joinable())
+		throw std::logic_error("poller already running");
+
+	if (ExecutorThread.joinable())
+		throw std::logic_error("polling doesn't work with the executor");
+
+	if (!DioLevel[0] && !DioLevel[1] && !DioLevel[2])
+		throw std::logic_error("no DIO line to poll");
+
+	if (config.mode == IrqMode::Interrupt)
+		return;
+
+	if (config.thread.lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE))
+		throw ExceptionWithErrno("failed to lock memory");
+
+	PollCfg = config;
+	RateWindowStart = EventClockNs();
+	RateEvents = 0;
+	Polling = config.mode == IrqMode::Polling;
+	PollRun = true;
+
+	try {
+		PollThread.start(config.thread, [this](){
+			PollLoop();
+		});
+	} catch (...) {
+		PollRun = false;
+		Polling = false;
+		throw;
+	}
+}
+
+void SX128x_Linux::StopPolling() {
+	if (!PollThread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lg(PollWaitLock);
+		PollRun = false;
+	}
+	PollWake.notify_one();
+
+	PollThread.join();
+}
+
+bool SX128x_Linux::IsPolling() const {
+	return PollRun.load(std::memory_order_acquire) && Polling.load(std::memory_order_acquire);
+}
+
+bool SX128x_Linux::RateWindowDone(uint64_t now, uint32_t &rate) {
+	uint64_t elapsed = now - RateWindowStart;
+
+	if (elapsed < (uint64_t)std::chrono::nanoseconds(PollCfg.window).count())
+		return false;
+
+	rate = (uint32_t)((uint64_t)RateEvents * 1000000000 / elapsed);
+	RateWindowStart = now;
+	RateEvents = 0;
+
+	return true;
+}
+
+void SX128x_Linux::OnPolledDioEdge(int line, uint64_t timestamp) {
+	std::lock_guard<std::mutex> lg(DioLock);
+
+	// The poller owns the lines, or already served this edge from the line level
+	if (Polling.load(std::memory_order_acquire) || timestamp <= LastPolled[line].load(std::memory_order_relaxed))
+		return;
+
+	RecordIrqLatency(timestamp);
+	ServeDio(line, timestamp);
+	RateEvents++;
+
+	uint32_t rate;
+	if (PollCfg.mode == IrqMode::Auto && RateWindowDone(EventClockNs(), rate) && rate >= PollCfg.enter_rate) {
+		{
+			std::lock_guard<std::mutex> wl(PollWaitLock);
+			Polling = true;
+		}
+		PollWake.notify_one();
+	}
+}
+
+// Call with DioLock held
+bool SX128x_Linux::ServePolledDio(int line) {
+	if (!DioLevel[line] || !DioLevel[line]->read())
+		return false;
+
+	// Taken before the status read and clear: an IRQ rising after it has a later edge,
+	// which the IRQ thread must not take for this one
+	uint64_t now = EventClockNs();
+
+	ProcessDioIrq(static_cast<GpioPinFunction_t>(GPIO_PIN_DIO1 + line));
+
+	LastPolled[line].store(now, std::memory_order_release);
+	RateEvents++;
+
+	return true;
+}
+
+// Call with DioLock held and Polling cleared. A line left high would never
+// give the IRQ thread an edge, so serve what's high. An IRQ raised after its
+// clear is a new edge for the IRQ thread, a few passes only catch the stragglers:
+// under a sustained rate this would never end otherwise.
+void SX128x_Linux::DrainPolledDio() {
+	bool served = true;
+
+	for (int pass = 0; pass < 4 && served; pass++) {
+		served = false;
+		for (int l = 0; l < 3; l++)
+			served |= ServePolledDio(l);
+	}
+}
+
+void SX128x_Linux::PollLoop() {
+	try {
+		while (PollRun.load(std::memory_order_acquire)) {
+			if (!Polling.load(std::memory_order_acquire)) {
+				std::unique_lock<std::mutex> lk(PollWaitLock);
+				PollWake.wait(lk, [this]() { return Polling.load() || !PollRun.load(); });
+				continue;
+			}
+
+			for (int l = 0; l < 3; l++) {
+				// Cheap unlocked look first, the IRQ thread may serve it meanwhile
+				if (DioLevel[l] && DioLevel[l]->read()) {
+					std::lock_guard<std::mutex> lg(DioLock);
+					ServePolledDio(l);
+				}
+			}
+
+			if (PollCfg.mode != IrqMode::Auto)
+				continue;
+
+			uint64_t now = EventClockNs();
+			uint32_t rate;
+
+			std::lock_guard<std::mutex> lg(DioLock);
+			if (RateWindowDone(now, rate) && rate < PollCfg.leave_rate) {
+				Polling = false;
+
+				// Serve what came in since the last look, edges from here on go to the IRQ thread
+				DrainPolledDio();
+			}
+		}
+	} catch (...) {
+		// A line that can't be read anymore, leave it to interrupts
+	}
+
+	std::lock_guard<std::mutex> lg(DioLock);
+	Polling = false;
+
+	try {
+		DrainPolledDio();
+	} catch (...) {
+	}
+
+	// Last, so the IRQ thread finding it cleared also sees the final LastPolled
+	PollRun.store(false, std::memory_order_release);
+}
+
+void SX128x_Linux::StartExecutor(int __cpu, int __prio) {
+	if (ExecutorThread.joinable())
+		throw std::logic_error("executor already running");
+
+	if (PollThread.joinable())
+		throw std::logic_error("the executor doesn't work with polling");
+
+	if ((ExecutorEvent = eventfd(0, EFD_CLOEXEC)) == -1)
+		throw ExceptionWithErrno("failed to create eventfd");
+
+	ExecutorRun = true;
+	ExecutorThread = std::thread(&SX128x_Linux::ExecutorLoop, this);
+
+	int rc = 0;
+
+	if (__cpu >= 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(__cpu, &cpus);
+		rc = pthread_setaffinity_np(ExecutorThread.native_handle(), sizeof(cpus), &cpus);
+	}
+
+	if (!rc && __prio > 0) {
+		sched_param param;
+		param.sched_priority = __prio;
+		rc = pthread_setschedparam(ExecutorThread.native_handle(), SCHED_RR, &param);
+	}
+
+	if (rc) {
+		StopExecutor();
+		throw std::system_error(rc, std::system_category(), "failed to set executor thread attributes");
+	}
+}
+
+void SX128x_Linux::StopExecutor() {
+	if (!ExecutorThread.joinable())
+		return;
+
+	ExecutorRun = false;
+
+	// Producers that got in before are done with the queue and the eventfd after this,
+	// later ones see the executor stopped
+	while (ExecutorUsers.load())
+		std::this_thread::yield();
+
+	ExecutorWake();
+	ExecutorThread.join();
+
+	close(ExecutorEvent);
+	ExecutorEvent = -1;
+
+	// What came in after the worker's last look. The DIO line stays high until served,
+	// with no new edge to get it served otherwise.
+	uint8_t lines = IrqPending.exchange(0);
+	for (int l = 0; l < 3; l++) {
+		if (lines & (1 << l))
+			ServeDio(l, PendingEdge[l].load(std::memory_order_relaxed));
+	}
+
+	std::function<void()> fn;
+	while (Commands.pop(fn)) {
+		fn();
+		fn = nullptr;
+	}
+}
+
+bool SX128x_Linux::ExecutorEnter() {
+	ExecutorUsers.fetch_add(1);
+
+	if (ExecutorRun.load())
+		return true;
+
+	ExecutorUsers.fetch_sub(1);
+	return false;
+}
+
+void SX128x_Linux::ExecutorLeave() {
+	ExecutorUsers.fetch_sub(1, std::memory_order_release);
+}
+
+// The radio whose executor runs on this thread
+static thread_local const SX128x_Linux *ExecutorOf = nullptr;
+
+void SX128x_Linux::Post(std::function<void()> fn) {
+	// The worker is the only consumer, it would spin on a full queue forever
+	if (ExecutorOf == this) {
+		fn();
+		return;
+	}
+
+	if (!ExecutorEnter())
+		throw std::logic_error("executor not running");
+
+	while (!Commands.push(std::move(fn)))
+		std::this_thread::yield();
+
+	ExecutorWake();
+	ExecutorLeave();
+}
+
+void SX128x_Linux::ExecutorWake() {
+	uint64_t one = 1;
+	write(ExecutorEvent, &one, sizeof(one));
+}
+
+void SX128x_Linux::ExecutorLoop() {
+	std::function<void()> fn;
+	uint64_t cnt;
+
+	ExecutorOf = this;
+
+	while (ExecutorRun.load(std::memory_order_acquire)) {
+		// One command at a time, so an interrupt never waits behind the whole queue
+		if (uint8_t lines = IrqPending.exchange(0, std::memory_order_acq_rel)) {
+			for (int l = 0; l < 3; l++) {
+				if (lines & (1 << l))
+					ServeDio(l, PendingEdge[l].load(std::memory_order_relaxed));
+			}
+			continue;
+		}
+
+		if (Commands.pop(fn)) {
+			fn();
+			fn = nullptr;
+			continue;
+		}
+
+		// Producers push before they signal, so nothing is missed between pop() and here
+		if (read(ExecutorEvent, &cnt, sizeof(cnt)) == -1 && errno != EINTR)
+			break;
+	}
+
+	while (Commands.pop(fn)) {
+		fn();
+		fn = nullptr;
+	}
+}
+
+uint8_t SX128x_Linux::HalDioLines() {
+	return (pin_cfg.dio1 >= 0 ? 0x01 : 0) | (pin_cfg.dio2 >= 0 ? 0x02 : 0) | (pin_cfg.dio3 >= 0 ? 0x04 : 0);
+}
+
 uint8_t SX128x_Linux::HalGpioRead(SX128x::GpioPinFunction_t func) {
 	switch (func) {
 		case SX128x::GPIO_PIN_BUSY:
-			return Busy.read();
+			return BusyEvent ? BusyEvent->read() : Busy->read();
 		default:
 			return 0;
 	}
 }
 
+bool SX128x_Linux::HalGpioWaitFallingEdge(SX128x::GpioPinFunction_t func, uint32_t timeoutUs) {
+	if (func != SX128x::GPIO_PIN_BUSY || !BusyEvent)
+		return false;
+
+	BusyEvent->wait(std::chrono::microseconds(timeoutUs));
+	return true;
+}
+
 void SX128x_Linux::HalGpioWrite(SX128x::GpioPinFunction_t func, uint8_t value) {
 	switch (func) {
 		case SX128x::GPIO_PIN_RESET:
@@ -93,19 +745,115 @@ void SX128x_Linux::HalGpioWrite(SX128x::GpioPinFunction_t func, uint8_t value) {
 }
 
 void SX128x_Linux::HalSpiTransfer(uint8_t *buffer_in, const uint8_t *buffer_out, uint16_t size) {
-	if (ExtLock) {
-		std::lock_guard<std::mutex> lg(*ExtLock);
+	std::unique_lock<std::mutex> lg;
+
+	if (ExtLock)
+		lg = std::unique_lock<std::mutex>(*ExtLock);
 
-		RadioNss.write(0);
+	if (RadioNss) {
+		RadioNss->write(0);
 		RadioSpi.transfer(buffer_out, buffer_in, size);
-		RadioNss.write(1);
+		RadioNss->write(1);
 	} else {
-		RadioNss.write(0);
-		RadioSpi.transfer(buffer_out, buffer_in, size);
-		RadioNss.write(1);
+		// cs_change on the last transfer would leave the chip selected
+		RadioSpi.transfer(buffer_out, buffer_in, size, false);
 	}
 }
 
+// spidev clocks out zeros for a NULL tx_buf and drops the data for a NULL rx_buf
+void SX128x_Linux::HalSpiRead(uint8_t *buffer_in, uint16_t size) {
+	HalSpiTransfer(buffer_in, nullptr, size);
+}
+
+void SX128x_Linux::HalSpiWrite(const uint8_t *buffer_out, uint16_t size) {
+	HalSpiTransfer(nullptr, buffer_out, size);
+}
+
+void SX128x_Linux::HalSpiTransferV(const SpiIoVec_t *iov, size_t count) {
+	// A truncated command would be taken by the chip as a different one
+	if (count > SPI_IOV_MAX_SEGMENTS)
+		throw std::length_error("too many SPI segments in one transaction");
+
+	SPPI_Transfer transfers[SPI_IOV_MAX_SEGMENTS];
+
+	// cs_change=0 keeps the chip selected from the header through the payload
+	for (size_t i=0; i<count; i++) {
+		transfers[i] = SPPI_Transfer(iov[i].buffer_out, iov[i].buffer_in, iov[i].size, 0, false);
+	}
+
+	std::unique_lock<std::mutex> lg;
+
+	if (ExtLock)
+		lg = std::unique_lock<std::mutex>(*ExtLock);
+
+	if (RadioNss) {
+		RadioNss->write(0);
+		RadioSpi.transfer(transfers, count);
+		RadioNss->write(1);
+	} else {
+		RadioSpi.transfer(transfers, count);
+	}
+}
+
+void SX128x_Linux::HalSpiTransferBatch(const SpiSegment_t *segments, size_t count) {
+	// A GPIO NSS cannot be toggled in the middle of a SPI message
+	if (RadioNss) {
+		SX128x::HalSpiTransferBatch(segments, count);
+		return;
+	}
+
+	SPPI_Transfer transfers[SPI_BATCH_MAX_SEGMENTS];
+
+	while (count) {
+		// Chip select is released between commands so the radio latches each one. BUSY only
+		// rises once it is released, so the controller's CS change gap is all a command gets
+		// before the next: the message ends after one needing longer, and BUSY is polled.
+		size_t n = 0;
+
+		while (n < count && n < SPI_BATCH_MAX_SEGMENTS) {
+			transfers[n] = SPPI_Transfer(segments[n].buffer_out, segments[n].buffer_in, segments[n].size, 0, true);
+
+			if (segments[n++].delay_usecs > SPI_CS_CHANGE_GAP_US)
+				break;
+		}
+
+		transfers[n-1].cs_change = 0;
+
+		{
+			std::unique_lock<std::mutex> lg;
+
+			if (ExtLock)
+				lg = std::unique_lock<std::mutex>(*ExtLock);
+
+			RadioSpi.transfer(transfers, n);
+		}
+
+		segments += n;
+		count -= n;
+
+		if (count)
+			WaitOnBusy(static_cast<RadioCommands_t>(segments[-1].buffer_out[0]));
+	}
+}
+
+void SX128x_Linux::HalSetRfPath(RfPath_t path) {
+	// Called from the IRQ thread without IOLock2 too, the cache and the lines change together
+	std::lock_guard<std::mutex> lg(RfPathLock);
+
+	if (path == RfPath)
+		return;
+
+	if (RfSwitch) {
+		// TXEN, RXEN
+		static const std::vector<uint8_t> values[] = {{0, 0}, {1, 0}, {0, 1}};
+		RfSwitch->write(values[path]);
+	} else {
+		SX128x::HalSetRfPath(path);
+	}
+
+	RfPath = path;
+}
+
 void SX128x_Linux::HalPreTx() {
 	if (TxEn) {
 		TxEn->write(1);
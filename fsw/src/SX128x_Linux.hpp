@@ -24,6 +24,16 @@
 #include <string>
 #include <thread>
 #include <optional>
+#include <chrono>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#include <pthread.h>
 
 #include <cinttypes>
 
@@ -31,28 +41,329 @@ using namespace YukiWorkshop;
 
 class SX128x_Linux : public SX128x {
 public:
+	enum class ChipSelect {
+		Gpio,		// NSS driven through the GPIO line pin_cfg.nss around each transfer
+		Hardware	// NSS driven by the SPI controller, nss must be the controller's CS pin
+	};
+
 	struct PinConfig {
 		int16_t busy = -1, nrst = -1, nss = -1, dio1 = -1, dio2 = -1, dio3 = -1;
 		int16_t tx_en = -1, rx_en = -1;
+		// Falls back to Hardware when no nss line is given
+		ChipSelect cs_mode = ChipSelect::Gpio;
+		// Wait for BUSY falling edges instead of polling, falls back to polling
+		// when the GPIO chip can't deliver events for the busy line
+		bool busy_events = true;
+	};
+
+	struct IrqThreadConfig {
+		std::vector<int> cpus;		// CPUs the IRQ thread may run on, any when empty
+		int policy = SCHED_RR;		// SCHED_OTHER, SCHED_FIFO or SCHED_RR
+		int priority = 50;		// Ignored with SCHED_OTHER
+		bool lock_memory = false;	// mlockall() the whole process before starting
+		size_t stack_prefault = 0;	// Bytes of stack touched by the thread before serving events
+	};
+
+	// Kernel edge timestamp to DIO handler entry
+	struct IrqLatencyStats {
+		uint64_t events = 0;
+		uint64_t min_ns = 0, max_ns = 0, total_ns = 0;
+
+		double mean_ns() const {
+			return events ? (double)total_ns / events : 0;
+		}
+	};
+
+	enum class IrqMode {
+		Interrupt,	// DIO edges wake the IRQ thread
+		Polling,	// A thread spins on the DIO line levels
+		Auto		// Polling while the DIO event rate is high, interrupts otherwise
+	};
+
+	struct PollConfig {
+		IrqMode mode = IrqMode::Auto;
+		IrqThreadConfig thread;			// Usually an isolated CPU and SCHED_FIFO
+		uint32_t enter_rate = 2000;		// Events per second from which Auto polls
+		uint32_t leave_rate = 200;		// Events per second under which Auto goes back to interrupts
+		std::chrono::milliseconds window{50};	// Rate measurement window
+	};
+
+	// Log-linear histogram of nanosecond latencies, 8 buckets per power of two (12.5% resolution).
+	// record() is lock-free and may run concurrently with the readers.
+	class LatencyHistogram {
+	public:
+		static constexpr int SubBits = 3;
+		static constexpr int Buckets = (41 - SubBits) << SubBits;	// Up to 2^40 ns, larger values land in the last bucket
+
+		void record(uint64_t ns);
+
+		uint64_t count() const;
+
+		uint64_t max() const {
+			return max_.load(std::memory_order_relaxed);
+		}
+
+		// Upper bound of the bucket holding the given quantile, 0 when empty
+		uint64_t percentile(double p) const;
+
+		// Events in bucket i and its upper bound, for dumping the whole histogram
+		uint64_t bucket_count(int i) const {
+			return counts_[i].load(std::memory_order_relaxed);
+		}
+
+		static uint64_t bucket_limit(int i);
+
+		void reset();
+
+	private:
+		std::atomic<uint64_t> counts_[Buckets] = {};
+		std::atomic<uint64_t> max_{0};
+
+		static int bucket(uint64_t ns);
+	};
+
+	enum class IrqLatencyStage {
+		Wake,		// Kernel edge timestamp to the DIO handler
+		StatusRead,	// Kernel edge timestamp to the IRQ status read and cleared
+		Callback,	// Kernel edge timestamp to the first callback
+		Count
+	};
+
+	struct SpiBenchmark {
+		double spi_only_ns = 0;		// One transfer as issued with ChipSelect::Hardware
+		double gpio_nss_ns = 0;		// The same transfer framed by two GPIO writes, as with ChipSelect::Gpio
 	};
 
 	SX128x_Linux(const std::string& spi_dev_path, uint16_t gpio_dev_num, PinConfig pin_config);
 
+	// Detaches from the reactor and stops the poller, the IRQ thread and the executor
+	~SX128x_Linux() override;
+
 	// For sync with multiple instances
 	void SetExternalLock(std::mutex& m);
 
 	void StartIrqHandler(int __prio = 50);
 
+	// Throws std::system_error when a setting can't be applied, the thread isn't left running then
+	void StartIrqHandler(const IrqThreadConfig& config);
+
 	void StopIrqHandler();
 
+	// Alternative to StartIrqHandler(): DIO events are served by a reactor shared with other radios,
+	// so the number of IRQ threads doesn't grow with the number of radios
+	void AttachIrqHandler(GPIO::Reactor& reactor);
+
+	// Returns once no handler of this radio runs on the reactor anymore, unless called from one
+	void DetachIrqHandler();
+
+	IrqLatencyStats GetIrqLatencyStats() const;
+
+	// Only DIO edges carrying a kernel timestamp are counted, not ProcessIrqs() called directly
+	// or lines served by the poller
+	const LatencyHistogram& GetIrqLatencyHistogram(IrqLatencyStage stage) const {
+		return IrqHistograms[(int)stage];
+	}
+
+	// Serves the DIO lines from a polling thread per config.mode. The edge events keep being delivered
+	// to the IRQ thread, which leaves alone the ones the poller already served. Not with the executor.
+	void StartPolling(const PollConfig& config);
+
+	void StopPolling();
+
+	// True while the poller serves the DIO lines
+	bool IsPolling() const;
+
+	void ResetIrqLatencyStats();
+
 	void SetSpiSpeed(uint32_t hz);
 
+	// Average cost per transaction of a GetStatus transfer, timed on both chip select paths.
+	// Don't run it while the radio is in use.
+	SpiBenchmark BenchmarkChipSelect(uint32_t iterations = 1000);
+
+	// Executor mode: one worker thread owns the radio and runs work submitted by other threads.
+	// DIO interrupts are serviced on the worker before the next queued command.
+	// Only work going through Submit() or Post() is serialized with the worker: calling the
+	// radio directly from another thread meanwhile races it.
+	// The worker is pinned to __cpu unless it's negative, and runs SCHED_RR with a non zero __prio.
+	void StartExecutor(int __cpu = -1, int __prio = 0);
+
+	// Stops the worker, the commands and DIO interrupts still queued are served before it returns.
+	// Post() refuses new work from the moment it is called.
+	void StopExecutor();
+
+	// Queues fn(SX128x&) to run on the worker, blocks only while the queue is full.
+	// Called from the worker itself, e.g. from a radio callback, fn runs before it returns.
+	template <typename F>
+	auto Submit(F&& fn) -> std::future<decltype(fn(std::declval<SX128x&>()))> {
+		typedef decltype(fn(std::declval<SX128x&>())) R;
+
+		auto task = std::make_shared<std::packaged_task<R()>>([this, fn = std::forward<F>(fn)]() mutable {
+			return fn(static_cast<SX128x&>(*this));
+		});
+		auto ret = task->get_future();
+		Post([task]() { (*task)(); });
+		return ret;
+	}
+
+	// Queues fn without a future, reporting completion is up to fn. fn must not throw.
+	// On the worker fn runs inline, waiting for room there would never end.
+	void Post(std::function<void()> fn);
+
 private:
+	// Bounded lock-free queue for many producers and one consumer, after D. Vyukov's MPMC queue
+	template <typename T, size_t N>
+	class MpscRing {
+		static_assert((N & (N - 1)) == 0, "N must be a power of 2");
+
+		struct Slot {
+			std::atomic<size_t> seq;
+			T value;
+		};
+
+		Slot slots[N];
+		alignas(64) std::atomic<size_t> head{0};
+		alignas(64) size_t tail = 0;
+
+	public:
+		MpscRing() {
+			for (size_t i=0; i<N; i++)
+				slots[i].seq.store(i, std::memory_order_relaxed);
+		}
+
+		// Any thread. Returns false when full.
+		bool push(T&& v) {
+			size_t pos = head.load(std::memory_order_relaxed);
+
+			for (;;) {
+				Slot &slot = slots[pos & (N - 1)];
+				size_t seq = slot.seq.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+				if (diff == 0) {
+					if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						slot.value = std::move(v);
+						slot.seq.store(pos + 1, std::memory_order_release);
+						return true;
+					}
+				} else if (diff < 0) {
+					return false;
+				} else {
+					pos = head.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		// Consumer thread only. Returns false when empty.
+		bool pop(T& v) {
+			Slot &slot = slots[tail & (N - 1)];
+
+			if (slot.seq.load(std::memory_order_acquire) != tail + 1)
+				return false;
+
+			v = std::move(slot.value);
+			slot.value = T();
+			slot.seq.store(tail + N, std::memory_order_release);
+			tail++;
+			return true;
+		}
+	};
+
+	// A pthread created with its affinity and scheduling already set, so a setting that
+	// can't be applied fails the creation instead of leaving a running thread to stop
+	class ConfiguredThread {
+	public:
+		// Throws std::system_error when the thread can't be created with config
+		void start(const IrqThreadConfig& config, std::function<void()> fn);
+
+		bool joinable() const {
+			return started;
+		}
+
+		void join();
+
+	private:
+		pthread_t tid{};
+		bool started = false;
+		size_t prefault = 0;
+		std::function<void()> body;
+
+		static void *entry(void *arg);
+	};
+
 	PinConfig pin_cfg;
 
+	static bool UseGpioNss(const PinConfig& pc) {
+		return pc.cs_mode == ChipSelect::Gpio && pc.nss >= 0;
+	}
+
 	std::mutex* ExtLock = nullptr;
 
-	std::thread IrqThread;
+	ConfiguredThread IrqThread;
+	GPIO::Reactor *IrqReactor = nullptr;
+
+	std::atomic<uint64_t> IrqEvents{0}, IrqLatencyMin{UINT64_MAX}, IrqLatencyMax{0}, IrqLatencyTotal{0};
+
+	void RecordIrqLatency(uint64_t timestamp);
+
+	LatencyHistogram IrqHistograms[(int)IrqLatencyStage::Count];
+
+	// Edge timestamps handed to the executor with IrqPending
+	std::atomic<uint64_t> PendingEdge[3] = {};
+
+	void ServeDio(int line, uint64_t timestamp);
+
+	void HalIrqStage(IrqStage_t stage) override;
+
+	// Level readers sharing the DIO event requests, for the poller
+	std::optional<GPIO::LineEvent> DioLevel[3];
+
+	ConfiguredThread PollThread;
+	PollConfig PollCfg;
+	std::atomic<bool> PollRun{false}, Polling{false};
+	std::mutex PollWaitLock;
+	std::condition_variable PollWake;
+
+	// The clock the kernel stamps the DIO events with, see GPIO::event_clock_id()
+	clockid_t EventClock = CLOCK_MONOTONIC;
+
+	// Now on EventClock, in ns
+	uint64_t EventClockNs() const;
+
+	// Serializes the poller and the IRQ thread on the DIO lines, guards the rate window too
+	std::mutex DioLock;
+	// Event clock time each line was last served by the poller. Edges up to then are already served.
+	std::atomic<uint64_t> LastPolled[3] = {};
+	uint64_t RateWindowStart = 0;
+	uint32_t RateEvents = 0;
+
+	void OnPolledDioEdge(int line, uint64_t timestamp);
+
+	bool ServePolledDio(int line);
+
+	void DrainPolledDio();
+
+	bool RateWindowDone(uint64_t now, uint32_t& rate);
+
+	void PollLoop();
+
+	MpscRing<std::function<void()>, 64> Commands;
+	std::thread ExecutorThread;
+	std::atomic<bool> ExecutorRun{false};
+	// One bit per DIO line, bit 0 for DIO1
+	std::atomic<uint8_t> IrqPending{0};
+	int ExecutorEvent = -1;
+	// Producers between ExecutorEnter() and ExecutorLeave(), StopExecutor() waits them out
+	std::atomic<uint32_t> ExecutorUsers{0};
+
+	// False once the executor is stopping, the caller serves or refuses the work itself then
+	bool ExecutorEnter();
+
+	void ExecutorLeave();
+
+	void ExecutorLoop();
+
+	void ExecutorWake();
 
 	SPPI RadioSpi;
 	GPIO::Device RadioGpio;
@@ -61,18 +372,46 @@ private:
 	//cfs GPIO::LineSingle RadioNss;
 	//cfs GPIO::LineSingle RadioReset;
 	//cfs GPIO::LineSingle Busy;
-   GPIO::LineSingle Busy;       //cfs Changed order to match SX128x_Linux.cpp construction order
-   GPIO::LineSingle RadioNss;   //cfs 
-	GPIO::LineSingle RadioReset; //cfs 
+	GPIO::LineSingle RadioReset;
+
+	// Exactly one is set: BusyEvent with pin_cfg.busy_events, Busy otherwise
+	std::optional<GPIO::LineEvent> BusyEvent;
+	std::optional<GPIO::LineSingle> Busy;
+
+	// Not set with ChipSelect::Hardware
+	std::optional<GPIO::LineSingle> RadioNss;
 
+	// RfSwitch when both TXEN and RXEN are configured, TxEn or RxEn otherwise
+	std::optional<GPIO::LineMultiple> RfSwitch;
 	std::optional<GPIO::LineSingle> TxEn, RxEn;
+	// Last path written to the switch lines, guarded by RfPathLock
+	std::mutex RfPathLock;
+	RfPath_t RfPath = RF_PATH_OFF;
+
+	// Time chip select stays released between the transfers of a spidev message, the
+	// SPI core's default cs_change_delay. spidev has no way to set it.
+	static constexpr uint16_t SPI_CS_CHANGE_GAP_US = 10;
 
 	uint8_t HalGpioRead(GpioPinFunction_t func) override;
 
+	uint8_t HalDioLines() override;
+
 	void HalGpioWrite(GpioPinFunction_t func, uint8_t value) override;
 
+	bool HalGpioWaitFallingEdge(GpioPinFunction_t func, uint32_t timeoutUs) override;
+
 	void HalSpiTransfer(uint8_t *buffer_in, const uint8_t *buffer_out, uint16_t size) override;
 
+	void HalSpiRead(uint8_t *buffer_in, uint16_t size) override;
+
+	void HalSpiWrite(const uint8_t *buffer_out, uint16_t size) override;
+
+	void HalSpiTransferV(const SpiIoVec_t *iov, size_t count) override;
+
+	void HalSpiTransferBatch(const SpiSegment_t *segments, size_t count) override;
+
+	void HalSetRfPath(RfPath_t path) override;
+
 	void HalPreTx() override;
 
 	void HalPreRx() override;
@@ -56,6 +56,7 @@
 #define CFG_RADIO_SPI_DEV_STR  RADIO_SPI_DEV_STR
 #define CFG_RADIO_SPI_DEV_NUM  RADIO_SPI_DEV_NUM
 #define CFG_RADIO_SPI_SPEED    RADIO_SPI_SPEED
+#define CFG_RADIO_SPI_HW_CS    RADIO_SPI_HW_CS
 #define CFG_RADIO_PIN_BUSY     RADIO_PIN_BUSY
 #define CFG_RADIO_PIN_NRST     RADIO_PIN_NRST
 #define CFG_RADIO_PIN_NSS      RADIO_PIN_NSS
@@ -64,11 +65,17 @@
 #define CFG_RADIO_PIN_DIO3     RADIO_PIN_DIO3
 #define CFG_RADIO_PIN_TX_EN    RADIO_PIN_TX_EN   
 #define CFG_RADIO_PIN_RX_EN    RADIO_PIN_RX_EN
+#define CFG_RADIO_IRQ_CPU      RADIO_IRQ_CPU
+#define CFG_RADIO_IRQ_POLICY   RADIO_IRQ_POLICY
+#define CFG_RADIO_IRQ_PRIO     RADIO_IRQ_PRIO
+#define CFG_RADIO_IRQ_MLOCK    RADIO_IRQ_MLOCK
+#define CFG_RADIO_IRQ_STACK    RADIO_IRQ_STACK
 
 #define LIB_CONFIG(XX) \
    XX(RADIO_SPI_DEV_STR,char*) \
    XX(RADIO_SPI_DEV_NUM,uint32) \
    XX(RADIO_SPI_SPEED,uint32) \
+   XX(RADIO_SPI_HW_CS,uint32) \
    XX(RADIO_PIN_BUSY,uint32) \
    XX(RADIO_PIN_NRST,uint32) \
    XX(RADIO_PIN_NSS,uint32) \
@@ -76,7 +83,12 @@
    XX(RADIO_PIN_DIO2,uint32) \
    XX(RADIO_PIN_DIO3,uint32) \
    XX(RADIO_PIN_TX_EN,uint32) \
-   XX(RADIO_PIN_RX_EN,uint32)
+   XX(RADIO_PIN_RX_EN,uint32) \
+   XX(RADIO_IRQ_CPU,uint32) \
+   XX(RADIO_IRQ_POLICY,uint32) \
+   XX(RADIO_IRQ_PRIO,uint32) \
+   XX(RADIO_IRQ_MLOCK,uint32) \
+   XX(RADIO_IRQ_STACK,uint32)
 
 DECLARE_ENUM(Config,LIB_CONFIG)
 
@@ -45,6 +45,8 @@ extern "C"
 // Pins based on hardware configuration
 SX128x_Linux *Radio = NULL;
 
+static char ErrorStr[128] = "";
+
 
 /*******************************/
 /** Local Function Prototypes **/
@@ -73,6 +75,7 @@ bool RADIO_Constructor(const char *SpiDevStr, uint8_t SpiDevNum, const RADIO_Pin
    PinConfig.dio3  = RadioPin->Dio3;
    PinConfig.tx_en = RadioPin->TxEn;
    PinConfig.rx_en = RadioPin->RxEn;
+   PinConfig.cs_mode = RadioPin->HwNss ? SX128x_Linux::ChipSelect::Hardware : SX128x_Linux::ChipSelect::Gpio;
    
    try
    {
@@ -89,6 +92,62 @@ bool RADIO_Constructor(const char *SpiDevStr, uint8_t SpiDevNum, const RADIO_Pin
 } /* End RADIO_Constructor() */
 
 
+/******************************************************************************
+** Function: RADIO_StartIrqHandler
+**
+** Start the thread serving the radio DIO interrupts
+**
+** Notes:
+**   None
+**
+*/
+bool RADIO_StartIrqHandler(const RADIO_IrqThread_t *IrqThread)
+{
+   bool RetStatus = false;
+   
+   SX128x_Linux::IrqThreadConfig Config;
+   
+   if (IrqThread->Cpu >= 0)
+   {
+      Config.cpus.push_back(IrqThread->Cpu);
+   }
+   Config.policy         = IrqThread->Policy;
+   Config.priority       = IrqThread->Priority;
+   Config.lock_memory    = IrqThread->LockMemory;
+   Config.stack_prefault = IrqThread->StackPrefault;
+   
+   try
+   {
+      Radio->StartIrqHandler(Config);
+      RetStatus = true;
+   }
+   catch (const std::exception &e)
+   {
+      strncpy(ErrorStr, e.what(), sizeof(ErrorStr) - 1);
+      RetStatus = false;
+   }
+   
+   return RetStatus;
+   
+} /* End RADIO_StartIrqHandler() */
+
+
+/******************************************************************************
+** Function: RADIO_GetErrorStr
+**
+** Return the reason the last failing radio call gave
+**
+** Notes:
+**   None
+**
+*/
+const char *RADIO_GetErrorStr(void)
+{
+   return ErrorStr;
+   
+} /* End RADIO_GetErrorStr() */
+
+
 /******************************************************************************
 ** Function: RADIO_SetLowNoiseAmpMode
 **
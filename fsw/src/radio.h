@@ -42,20 +42,38 @@
 /**********************/
 
 
+/*
+** Pin numbers are GPIO line offsets, -1 for an unused pin
+*/
 typedef struct
 {
-   uint8_t Busy;
-   uint8_t Nrst;
-   uint8_t Nss;
-   uint8_t Dio1;
-   uint8_t Dio2;
-   uint8_t Dio3;
-   uint8_t TxEn;
-   uint8_t RxEn;
+   int16_t Busy;
+   int16_t Nrst;
+   int16_t Nss;
+   int16_t Dio1;
+   int16_t Dio2;
+   int16_t Dio3;
+   int16_t TxEn;
+   int16_t RxEn;
+   bool    HwNss;    /* true: SPI controller drives NSS, false: Nss GPIO line */
       
 } RADIO_Pin_t;
 
 
+/*
+** IRQ thread scheduling, Policy uses the Linux SCHED_* values
+*/
+typedef struct
+{
+   int16_t  Cpu;           /* -1: any CPU */
+   uint8_t  Policy;
+   uint8_t  Priority;
+   bool     LockMemory;
+   uint32_t StackPrefault; /* Stack bytes touched before serving events */
+
+} RADIO_IrqThread_t;
+
+
 /************************/
 /** Exported Functions **/
 /************************/
@@ -73,6 +91,32 @@ typedef struct
 bool RADIO_Constructor(const char *SpiDevStr, uint8_t SpiDevNum, const RADIO_Pin_t *RadioPin);
 
 
+/******************************************************************************
+** Function: RADIO_StartIrqHandler
+**
+** Start the thread serving the radio DIO interrupts
+**
+** Notes:
+**   1. Fails when a scheduling setting can't be applied, e.g. a real-time
+**      policy without the needed privileges. RADIO_GetErrorStr() then
+**      returns the reason.
+**
+*/
+bool RADIO_StartIrqHandler(const RADIO_IrqThread_t *IrqThread);
+
+
+/******************************************************************************
+** Function: RADIO_GetErrorStr
+**
+** Return the reason the last failing radio call gave
+**
+** Notes:
+**   1. Empty when no call failed. Valid until the next failing call.
+**
+*/
+const char *RADIO_GetErrorStr(void);
+
+
 /******************************************************************************
 ** Function: RADIO_SetLowNoiseAmpMode
 **
@@ -137,6 +137,7 @@ static bool InitRadio(void)
    RadioPin.Dio3 = INITBL_GetIntConfig(INITBL_OBJ, CFG_RADIO_PIN_DIO3);
    RadioPin.TxEn = INITBL_GetIntConfig(INITBL_OBJ, CFG_RADIO_PIN_TX_EN);
    RadioPin.RxEn = INITBL_GetIntConfig(INITBL_OBJ, CFG_RADIO_PIN_RX_EN);
+   RadioPin.HwNss = (INITBL_GetIntConfig(INITBL_OBJ, CFG_RADIO_SPI_HW_CS) != 0);
    
    RetStatus = RADIO_Constructor(INITBL_GetStrConfig(INITBL_OBJ, CFG_RADIO_SPI_DEV_STR),
                                  INITBL_GetIntConfig(INITBL_OBJ, CFG_RADIO_SPI_DEV_NUM),
@@ -144,7 +145,33 @@ static bool InitRadio(void)
    
    if (RetStatus)
    {
+      RADIO_IrqThread_t IrqThread;
+      
       RADIO_SetSpiSpeed(INITBL_GetIntConfig(INITBL_OBJ, CFG_RADIO_SPI_SPEED));
+      
+      IrqThread.Cpu           = INITBL_GetIntConfig(INITBL_OBJ, CFG_RADIO_IRQ_CPU);
+      IrqThread.Policy        = INITBL_GetIntConfig(INITBL_OBJ, CFG_RADIO_IRQ_POLICY);
+      IrqThread.Priority      = INITBL_GetIntConfig(INITBL_OBJ, CFG_RADIO_IRQ_PRIO);
+      IrqThread.LockMemory    = (INITBL_GetIntConfig(INITBL_OBJ, CFG_RADIO_IRQ_MLOCK) != 0);
+      IrqThread.StackPrefault = INITBL_GetIntConfig(INITBL_OBJ, CFG_RADIO_IRQ_STACK);
+      
+      if (!RADIO_StartIrqHandler(&IrqThread))
+      {
+         OS_printf("Error starting SX128X Library IRQ thread: %s. Retrying without CPU pinning, memory locking or real-time priority\n",
+                   RADIO_GetErrorStr());
+         
+         IrqThread.Cpu        = -1;
+         IrqThread.Policy     = 0;  /* SCHED_OTHER */
+         IrqThread.Priority   = 0;
+         IrqThread.LockMemory = false;
+         
+         /* The radio stays usable without the thread, DIO interrupts are just not served */
+         if (!RADIO_StartIrqHandler(&IrqThread))
+         {
+            OS_printf("Error starting SX128X Library IRQ thread: %s. DIO interrupts are not served\n",
+                      RADIO_GetErrorStr());
+         }
+      }
    }
    
    return RetStatus;